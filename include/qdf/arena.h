@@ -0,0 +1,70 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_ARENA_H
+#define LIBQDF_ARENA_H
+
+struct qdf_arena_block;
+
+/*
+ * A bump allocator. Memory is handed out from large blocks in turn, and
+ * is never freed singly; it's all given back at once by qdf_arena_reset(),
+ * or back to a mark by qdf_arena_release(). Blocks are kept for reuse
+ * rather than freed, so an arena reset between pages settles at the
+ * size the largest page needed, and stops calling malloc(3) at all.
+ *
+ * Object trees for qdf_print_object() and qdf_doc_def() can be built here,
+ * since nothing printed is kept past the call. Each sink has an arena of
+ * its own, which the library uses for scratch memory while printing; see
+ * struct qdf_sink.
+ */
+
+#define QDF_ARENA_BLOCKSZ (256 * 1024)
+
+struct qdf_arena {
+	struct qdf_arena_block *block; /* the current block, chained to earlier ones */
+	struct qdf_arena_block *spare; /* blocks emptied, for reuse */
+	size_t blocksz;
+};
+
+/* A point to release back to, from qdf_arena_mark() */
+struct qdf_arena_mark {
+	struct qdf_arena_block *block;
+	size_t n;
+};
+
+/* Allocates nothing until first used. A blocksz of 0 means QDF_ARENA_BLOCKSZ */
+void
+qdf_arena_init(struct qdf_arena *a, size_t blocksz);
+
+/*
+ * Returns n bytes, aligned for any type, or NULL with errno set.
+ * Allocations larger than a block get a block to themselves.
+ */
+void *
+qdf_arena_alloc(struct qdf_arena *a, size_t n);
+
+/* As qdf_arena_alloc(), for n items of the given size, zeroed */
+void *
+qdf_arena_calloc(struct qdf_arena *a, size_t n, size_t size);
+
+struct qdf_arena_mark
+qdf_arena_mark(const struct qdf_arena *a);
+
+/* Gives back everything allocated since the mark was taken */
+void
+qdf_arena_release(struct qdf_arena *a, struct qdf_arena_mark m);
+
+/* Gives back everything, keeping the blocks */
+void
+qdf_arena_reset(struct qdf_arena *a);
+
+/* Frees the blocks */
+void
+qdf_arena_fini(struct qdf_arena *a);
+
+#endif
+
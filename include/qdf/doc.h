@@ -0,0 +1,171 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_DOC_H
+#define LIBQDF_DOC_H
+
+/*
+ * Where an object is: a byte offset, or in an object stream. Neither is
+ * set for an id which is allocated but not yet defined.
+ */
+struct qdf_xref {
+	uint64_t off;   /* byte offset, or 0 */
+	unsigned stm;   /* the object stream holding it, or 0 */
+	unsigned index; /* its position within stm */
+};
+
+struct qdf_objstm;
+struct qdf_lin;
+struct qdf_dedup;
+
+/*
+ * ISO PDF 2.0 Annex F.3 What an object is needed for, which decides
+ * where it goes in linearized output. See qdf_doc_init_linear().
+ */
+enum qdf_lin_part {
+	QDF_LIN_OTHER,  /* for no page in particular: part 9 */
+	QDF_LIN_DOC,    /* for opening the document, as the catalog is: part 4 */
+	QDF_LIN_PAGE,   /* for the current page alone; see qdf_doc_page() */
+	QDF_LIN_SHARED  /* for several pages: part 8, or part 6 if the first page uses it */
+};
+
+/*
+ * A whole PDF file: the header, indirect objects, and the cross-reference
+ * table and trailer. Object offsets are taken from the sink as each object
+ * is printed, and kept by id. Ids may be allocated ahead of their
+ * definitions, so that objects can refer forwards; an id which is never
+ * defined is written as a free entry, and references to it read as null.
+ */
+struct qdf_doc {
+	struct qdf_sink *sink;
+	enum qdf_version ver;
+
+	unsigned root; /* the catalog; required by qdf_doc_end() */
+	unsigned info; /* the document information dictionary, or 0 */
+
+	/*
+	 * ISO PDF 2.0 14.4 The first of the file's two identifiers, which
+	 * stays the same across updates. If empty, one is made up.
+	 */
+	struct qdf_data id;
+
+	/*
+	 * PDF 1.5 and later: objects other than streams are packed into
+	 * compressed object streams, and the cross-reference table is written
+	 * as a stream too. Set by qdf_doc_init() where the version allows.
+	 * A cross-reference stream is also used regardless when offsets
+	 * outgrow the table.
+	 */
+	bool objstm;
+
+	uint64_t prev;  /* the previous cross-reference section, for updates */
+	unsigned start; /* the first id allocated here; those below are inherited */
+	unsigned head;  /* the previous free list, chained after ids freed here */
+
+	unsigned next; /* the next id to allocate */
+	size_t size;   /* capacity of x[] */
+	struct qdf_xref *x;
+
+	struct qdf_objstm *pending; /* objects packed, but not yet printed */
+
+	enum qdf_lin_part part; /* for objects defined next, when linearized */
+	struct qdf_lin *lin;    /* or NULL */
+
+	struct qdf_dedup *dedup; /* for qdf_doc_put(), or NULL */
+};
+
+/* Prints the header. The sink must be at the start of the file */
+bool
+qdf_doc_init(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver);
+
+/*
+ * ISO PDF 2.0 7.5.6 Appends an incremental update to an existing file,
+ * len bytes long, whose last cross-reference section is at prev and whose
+ * trailer gives size as /Size. The sink must be new, writing to the end of
+ * that file. Ids continue from size, and defining an existing id replaces
+ * that object. Only the objects defined here are written, and the new
+ * cross-reference section chains to prev.
+ *
+ * head is the object number in the previous section's entry 0, which
+ * heads its free list (ISO PDF 2.0 7.5.4); ids left free here are linked
+ * in front of it, so that the existing free entries stay reachable.
+ *
+ * The caller sets root and info from the previous trailer, and id from
+ * its /ID. The new section is a stream if doc->objstm is set, and that
+ * ought to match the existing file's kind.
+ */
+bool
+qdf_doc_init_update(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver,
+	uint64_t len, uint64_t prev, unsigned size, unsigned head);
+
+/*
+ * ISO PDF 2.0 Annex F Linearized output, for viewers which display the
+ * first page before the rest of the file has arrived. Objects are written
+ * to the spill file as they're defined, which must be empty and open for
+ * reading and writing. qdf_doc_end() then writes the whole file to the
+ * sink, in the order Annex F gives, renumbered to suit, with the
+ * linearization dictionary and hint tables.
+ *
+ * The caller says what each object is for by setting doc->part before
+ * defining it, and calls qdf_doc_page() for each page in order. Which pages
+ * use which shared objects is found from their references. The catalog
+ * always goes with the objects for opening the document.
+ *
+ * Objects aren't packed into object streams here.
+ */
+bool
+qdf_doc_init_linear(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver,
+	int spill);
+
+/*
+ * Starts the next page, whose page object is id. Objects defined after
+ * this are for that page, until doc->part is changed. Does nothing unless
+ * the doc is linearized.
+ */
+bool
+qdf_doc_page(struct qdf_doc *doc, unsigned id);
+
+/* Returns a new id, or 0 with errno set */
+unsigned
+qdf_doc_alloc(struct qdf_doc *doc);
+
+bool
+qdf_doc_def(struct qdf_doc *doc, unsigned id, const struct qdf_object *o);
+
+/*
+ * Defines o under a new id, unless an object with the same content was
+ * defined here by qdf_doc_put() already, in which case its id is returned
+ * and nothing is written. Content is compared by hash: dictionaries in any
+ * order, and streams by their filters and data. Objects are only ever
+ * matched against others given here, not those from qdf_doc_def().
+ *
+ * A stream read from a QDF_SOURCE_READ callback can't be read twice,
+ * and is always written. Returns 0 with errno set.
+ *
+ * When linearized, an object first put for one page and then for another
+ * becomes shared.
+ */
+unsigned
+qdf_doc_put(struct qdf_doc *doc, const struct qdf_object *o);
+
+/* As qdf_stream_begin(), with an id allocated for /Length */
+bool
+qdf_doc_stream_begin(struct qdf_doc *doc, struct qdf_stream_writer *w,
+	unsigned id, const struct qdf_filter_array *filters);
+
+/* As qdf_stream_end(), defining the length object */
+bool
+qdf_doc_stream_end(struct qdf_doc *doc, struct qdf_stream_writer *w);
+
+/*
+ * Prints the cross-reference table and trailer, and flushes the sink.
+ * Frees the doc's resources either way.
+ */
+bool
+qdf_doc_end(struct qdf_doc *doc);
+
+#endif
+
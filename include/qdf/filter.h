@@ -20,6 +20,24 @@ enum qdf_filter_type {
 	/* Not implemented: QDF_FILTER_CRYPT */
 };
 
+/*
+ * Settings for encoding. Unlike the parameters above, these are not
+ * written to the PDF; they affect only how the data is produced.
+ * Zero for any field means its default.
+ */
+struct qdf_filter_enc {
+	int level; /* Flate: 1 (fastest) to 9 (smallest) */
+
+	/*
+	 * Flate: compress in blocks of this many bytes, each primed with the
+	 * 32 KiB preceding it, spread across this many threads. Setting either
+	 * selects block mode. The output depends only on the level and block
+	 * size, so it is the same for any number of threads.
+	 */
+	size_t block;
+	unsigned threads;
+};
+
 struct qdf_filter {
 	enum qdf_filter_type type;
 	union {
@@ -28,10 +46,60 @@ struct qdf_filter {
 		struct qdf_param_jbig2 jbig2;
 		struct qdf_param_dct dct;
 	} u;
+	struct qdf_filter_enc enc;
 };
 
 const char *
 qdf_filter_name(enum qdf_filter_type type);
 
+/*
+ * Receives a filter's output a chunk at a time. Returns false with errno
+ * set to stop filtering.
+ */
+typedef bool (qdf_filter_emit)(void *opaque, const void *p, size_t n);
+
+/*
+ * Decodes through each filter in a, in /Filter order, handing the output
+ * to emit() as it's produced. Only a few chunks are held at once, however
+ * large the decoded data.
+ */
+bool
+qdf_filter_decode_stream(const struct qdf_filter_array *a,
+	const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque);
+
+struct qdf_filter_chain;
+
+/*
+ * As qdf_filter_decode_stream(), for encoded data given a piece at a
+ * time, e.g. as it's read from a file. qdf_filter_decode_end() flushes
+ * what's held and releases d; it must be called after
+ * qdf_filter_decode_begin() succeeds, even if an update fails.
+ */
+struct qdf_filter_decoder {
+	struct qdf_filter_chain *chain; /* opaque */
+};
+
+bool
+qdf_filter_decode_begin(struct qdf_filter_decoder *d,
+	const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque);
+
+bool
+qdf_filter_decode_update(struct qdf_filter_decoder *d, const void *p, size_t n);
+
+bool
+qdf_filter_decode_end(struct qdf_filter_decoder *d);
+
+/*
+ * Decodes into the caller's buffer, typically sized by the stream's /DL.
+ * *outsz gives the length decoded. If the data doesn't fit, this fails
+ * with ENOBUFS, and buf holds as much as fits.
+ */
+bool
+qdf_filter_decode_buf(const struct qdf_filter_array *a,
+	const void *in, size_t n,
+	void *buf, size_t size, size_t *outsz);
+
 #endif
 
@@ -8,25 +8,25 @@
 #define LIBQDF_OBJECT_H
 
 void
-qdf_vprintf_comment(FILE *f, const char *fmt, va_list ap);
+qdf_vprintf_comment(struct qdf_sink *sink, const char *fmt, va_list ap);
 
 void
-qdf_printf_comment(FILE *f, const char *fmt, ...);
+qdf_printf_comment(struct qdf_sink *sink, const char *fmt, ...);
 
 void
-qdf_print_object(FILE *f, const struct qdf_object *o);
+qdf_print_object(struct qdf_sink *sink, const struct qdf_object *o);
 
 void
-qdf_print_def(FILE *f, unsigned id, const struct qdf_object *o);
+qdf_print_def(struct qdf_sink *sink, unsigned id, const struct qdf_object *o);
 
 void
-qdf_print_array(FILE *f, const struct qdf_array *a);
+qdf_print_array(struct qdf_sink *sink, const struct qdf_array *a);
 
 void
-qdf_print_dict(FILE *f, const struct qdf_dict *d);
+qdf_print_dict(struct qdf_sink *sink, const struct qdf_dict *d);
 
 bool
-qdf_print_stream(FILE *f, const struct qdf_stream *st);
+qdf_print_stream(struct qdf_sink *sink, const struct qdf_stream *st);
 
 #endif
 
@@ -8,22 +8,61 @@
 #define LIBQDF_PRINT_H
 
 void
-qdf_print_comment(FILE *f, const char *s);
+qdf_print_comment(struct qdf_sink *sink, const char *s);
 
 void
-qdf_print_object(FILE *f, const struct qdf_object *o);
+qdf_print_object(struct qdf_sink *sink, const struct qdf_object *o);
 
 void
-qdf_print_def(FILE *f, unsigned id, const struct qdf_object *o);
+qdf_print_def(struct qdf_sink *sink, unsigned id, const struct qdf_object *o);
 
 void
-qdf_print_array(FILE *f, const struct qdf_array *a);
+qdf_print_array(struct qdf_sink *sink, const struct qdf_array *a);
 
 void
-qdf_print_dict(FILE *f, const struct qdf_dict *d);
+qdf_print_dict(struct qdf_sink *sink, const struct qdf_dict *d);
 
 bool
-qdf_print_stream(FILE *f, const struct qdf_stream *st);
+qdf_print_stream(struct qdf_sink *sink, const struct qdf_stream *st);
+
+struct qdf_filter_chain;
+
+/*
+ * For a stream whose data is given a piece at a time. Each piece is
+ * encoded and printed as it's given, so the stream is never held whole.
+ * /Length is a reference to the object length_id, which qdf_stream_end()
+ * defines after the stream object, id, once the length is known.
+ */
+struct qdf_stream_writer {
+	struct qdf_sink *sink;
+	unsigned length_id;
+	size_t length; /* encoded bytes printed so far */
+
+	struct qdf_filter_chain *chain; /* opaque */
+};
+
+/* Prints the stream's dict, up to and including "stream" */
+bool
+qdf_stream_begin(struct qdf_stream_writer *w, struct qdf_sink *sink,
+	unsigned id, unsigned length_id, const struct qdf_filter_array *filters);
+
+bool
+qdf_stream_write(struct qdf_stream_writer *w, const void *p, size_t n);
+
+/* Reads src through to its end, as for qdf_stream_write() */
+bool
+qdf_stream_write_source(struct qdf_stream_writer *w, const struct qdf_source *src);
+
+/*
+ * Ends the stream object, leaving the length object to the caller,
+ * whose value is w->length. Cleans up either way.
+ */
+bool
+qdf_stream_close(struct qdf_stream_writer *w);
+
+/* As qdf_stream_close(), and then prints the length object */
+bool
+qdf_stream_end(struct qdf_stream_writer *w);
 
 #endif
 
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_SINK_H
+#define LIBQDF_SINK_H
+
+struct iovec;
+
+/*
+ * A sink is where printed output goes. Output is accumulated in a buffer,
+ * and handed to the write callback only when the buffer fills, or when
+ * a large span of data (e.g. stream contents) would not fit. In that case
+ * the pending buffer and the span are passed together as two iovecs,
+ * so that a callback backed by writev(2) issues a single system call.
+ *
+ * The callback must write everything it is given, and returns false
+ * with errno set on error. Errors are sticky: once a write fails,
+ * further output is discarded and the error is reported by
+ * qdf_sink_flush() and qdf_sink_fini().
+ */
+typedef bool (qdf_sink_write)(void *opaque, const struct iovec *iov, int iovcnt);
+
+#define QDF_SINK_BUFSZ (64 * 1024)
+#define QDF_SINK_MIN   512
+
+#define QDF_PRECISION_DEFAULT 8
+
+enum qdf_print_mode {
+	QDF_PRINT_READABLE, /* a space between every token */
+	QDF_PRINT_COMPACT   /* whitespace only where the syntax needs it */
+};
+
+struct qdf_sink {
+	qdf_sink_write *write;
+	void *opaque;
+
+	unsigned char *buf;
+	size_t size;
+	size_t n; /* bytes pending in buf */
+	bool owned;
+
+	int err; /* errno from the first failed write, or 0 */
+	int fd;  /* for qdf_sink_init_fd(), otherwise -1 */
+
+	/*
+	 * Maximum digits printed after the decimal point for reals.
+	 * Fewer are printed where they suffice to read back the same value.
+	 */
+	unsigned precision;
+
+	enum qdf_print_mode mode;
+	bool regular; /* the last token ended with a regular character */
+	bool bol;     /* the last token ended a line */
+
+	/*
+	 * Bytes handed to the write callback, or otherwise output, so far.
+	 * The current offset in the output is this plus n; see qdf_sink_offset().
+	 */
+	uint64_t written;
+
+	/*
+	 * Scratch memory for printing, given back before each call returns.
+	 * Callers may allocate from it too, e.g. for object trees, and reset
+	 * it between pages; but not during a call, as from a write callback.
+	 */
+	struct qdf_arena arena;
+};
+
+/*
+ * If buf is NULL, a buffer of the given size is allocated and owned by
+ * the sink (size 0 means QDF_SINK_BUFSZ). Otherwise the caller's buffer
+ * is used as-is, and must be at least QDF_SINK_MIN bytes.
+ */
+bool
+qdf_sink_init(struct qdf_sink *sink, void *buf, size_t size,
+	qdf_sink_write *write, void *opaque);
+
+/* Adapter for stdio */
+bool
+qdf_sink_init_file(struct qdf_sink *sink, void *buf, size_t size, FILE *f);
+
+/* Adapter for a file descriptor, by writev(2) */
+bool
+qdf_sink_init_fd(struct qdf_sink *sink, void *buf, size_t size, int fd);
+
+bool
+qdf_sink_flush(struct qdf_sink *sink);
+
+/* The number of bytes output so far, including those pending */
+uint64_t
+qdf_sink_offset(const struct qdf_sink *sink);
+
+/* Flushes, and frees the buffer if the sink owns it, and the arena */
+bool
+qdf_sink_fini(struct qdf_sink *sink);
+
+#endif
+
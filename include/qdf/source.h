@@ -0,0 +1,51 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_SOURCE_H
+#define LIBQDF_SOURCE_H
+
+struct iovec;
+
+/*
+ * Where a stream's data comes from, when it isn't held whole in memory.
+ * Data is read a chunk at a time, and passed through the stream's filters
+ * as it's read.
+ */
+enum qdf_source_type {
+	QDF_SOURCE_READ, /* a callback, for data produced on demand */
+	QDF_SOURCE_FD,   /* a range of a file, by pread(2) */
+	QDF_SOURCE_IOV   /* fragments in memory, used in place */
+};
+
+/*
+ * Fills up to size bytes of buf, setting *n to the count read, and 0 at
+ * the end of the data. Returns false with errno set on error.
+ */
+typedef bool (qdf_source_read)(void *opaque, void *buf, size_t size, size_t *n);
+
+struct qdf_source {
+	enum qdf_source_type type;
+	union {
+		struct {
+			qdf_source_read *read;
+			void *opaque;
+		} read;
+
+		struct {
+			int fd;
+			off_t offset;
+			size_t len;
+		} fd;
+
+		struct {
+			const struct iovec *iov;
+			int iovcnt;
+		} iov;
+	} u;
+};
+
+#endif
+
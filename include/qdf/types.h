@@ -8,6 +8,7 @@
 #define LIBQDF_TYPES_H
 
 struct qdf_filter;
+struct qdf_source;
 
 /*
  * ISO PDF 2.0 7.3.1 "PDF includes eight basic types of objects:
@@ -26,7 +27,9 @@ enum qdf_type {
 	QDF_TYPE_ARRAY,
 	QDF_TYPE_DICT,
 	QDF_TYPE_STREAM,
-	QDF_TYPE_NULL
+	QDF_TYPE_NULL,
+	QDF_TYPE_REF, /* not a basic type, but stands in for any of them */
+	QDF_TYPE_STRING_N /* a string by length in .data; may contain NUL */
 };
 
 /* ISO PDF 2.0 7.3.3 "The range and precision of numbers may be limited by the
@@ -42,6 +45,16 @@ typedef int_fast32_t qdf_int;
 typedef double       qdf_real;
 #define QDF_PRIr     "f"
 
+/*
+ * ISO PDF 2.0 7.3.10 "Any object in a PDF file may be labelled as an
+ * indirect object ... The object may be referred to from elsewhere in
+ * the file by an indirect reference", printed as N G R.
+ */
+struct qdf_ref {
+	unsigned id;
+	unsigned gen;
+};
+
 struct qdf_data {
 	const void *p;
 	size_t n;
@@ -65,6 +78,13 @@ struct qdf_filter_array {
 struct qdf_stream {
 	struct qdf_data data;
 	struct qdf_filter_array filters;
+	const struct qdf_source *src; /* if non-NULL, read instead of data */
+
+	/*
+	 * The data is already encoded, e.g. a JPEG for DCTDecode, and the
+	 * filters only describe it. It's copied to the output as-is.
+	 */
+	bool encoded;
 };
 
 struct qdf_object {
@@ -80,6 +100,7 @@ struct qdf_object {
 		struct qdf_array a;
 		struct qdf_dict d;
 		struct qdf_stream st;
+		struct qdf_ref ref;
 	} u;
 };
 
@@ -0,0 +1,518 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+
+#include "filter.h"
+#include "a85.h"
+
+/*
+ * ISO PDF 2.0 7.4.3 ASCII85Decode. Each group of four bytes is a big-endian
+ * 32-bit number written as five base-85 digits, '!' for 0 through 'u' for 84.
+ * An all-zero group is written as 'z', and a final partial group of n bytes
+ * is zero-padded and written as its first n + 1 digits. "~>" marks EOD.
+ */
+
+static uint32_t
+load_be32(const unsigned char *p)
+{
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+void
+a85_digits_scalar(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	uint32_t v;
+	size_t i;
+	int j;
+
+	assert(dst != NULL);
+	assert(src != NULL || n == 0);
+
+	for (i = 0; i < n; i++) {
+		v = load_be32(src + 4 * i);
+
+		for (j = 4; j >= 0; j--) {
+			dst[5 * i + j] = '!' + v % 85;
+			v /= 85;
+		}
+	}
+}
+
+#if defined(__SSE2__)
+
+/*
+ * v / 85 for all four lanes, as the high part of v * 0xC0C0C0C1 >> 38,
+ * which is exact for any 32-bit v. SSE2 multiplies only the even lanes,
+ * so the odd lanes are shifted down and done separately.
+ */
+static __m128i
+div85(__m128i v)
+{
+	const __m128i m = _mm_set1_epi32((int) 0xC0C0C0C1U);
+	__m128i even, odd;
+
+	even = _mm_srli_epi64(_mm_mul_epu32(v, m), 38);
+	odd  = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(v, 32), m), 38);
+
+	return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+/* Four groups per iteration */
+void
+a85_digits(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	const __m128i k85 = _mm_set1_epi32(85);
+	uint32_t w[4], d[5][4];
+	size_t i;
+	int j, g;
+
+	assert(dst != NULL);
+	assert(src != NULL || n == 0);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v, q;
+
+		for (g = 0; g < 4; g++) {
+			w[g] = load_be32(src + 4 * (i + g));
+		}
+
+		v = _mm_loadu_si128((const __m128i *) w);
+
+		for (j = 4; j > 0; j--) {
+			q = div85(v);
+
+			/* remainder is v - q * 85; q * 85 fits in 32 bits */
+			_mm_storeu_si128((__m128i *) d[j],
+				_mm_sub_epi32(v, _mm_or_si128(
+					_mm_mul_epu32(q, k85),
+					_mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(q, 32), k85), 32))));
+
+			v = q;
+		}
+
+		/* what's left is below 85 */
+		_mm_storeu_si128((__m128i *) d[0], v);
+
+		for (g = 0; g < 4; g++) {
+			for (j = 0; j < 5; j++) {
+				dst[5 * (i + g) + j] = '!' + d[j][g];
+			}
+		}
+	}
+
+	a85_digits_scalar(dst + 5 * i, src + 4 * i, n - i);
+}
+
+#else
+
+void
+a85_digits(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	a85_digits_scalar(dst, src, n);
+}
+
+#endif
+
+struct a85_enc {
+	unsigned char pend[4];
+	size_t npend;
+	size_t col;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+static bool
+a85_flush(struct filter_stage *st, unsigned char *out, size_t *n)
+{
+	assert(st != NULL);
+	assert(n != NULL);
+
+	if (*n == 0) {
+		return true;
+	}
+
+	if (!st->emit(st->opaque, out, *n)) {
+		return false;
+	}
+
+	*n = 0;
+
+	return true;
+}
+
+/* Appends s, breaking lines at A85_LINE */
+static bool
+a85_put(struct filter_stage *st, struct a85_enc *a, const unsigned char *s, size_t len)
+{
+	size_t k;
+
+	assert(st != NULL);
+	assert(a != NULL);
+
+	while (len > 0) {
+		if (a->col == A85_LINE) {
+			if (a->n == sizeof a->out && !a85_flush(st, a->out, &a->n)) {
+				return false;
+			}
+
+			a->out[a->n++] = '\n';
+			a->col = 0;
+		}
+
+		k = A85_LINE - a->col;
+		if (k > len) {
+			k = len;
+		}
+		if (k > sizeof a->out - a->n) {
+			k = sizeof a->out - a->n;
+		}
+
+		if (k == 0) {
+			if (!a85_flush(st, a->out, &a->n)) {
+				return false;
+			}
+			continue;
+		}
+
+		memcpy(a->out + a->n, s, k);
+		a->n   += k;
+		a->col += k;
+
+		s   += k;
+		len -= k;
+	}
+
+	return true;
+}
+
+/* Encodes whole groups, substituting 'z' for all-zero groups */
+static bool
+a85_groups(struct filter_stage *st, struct a85_enc *a, const unsigned char *p, size_t groups)
+{
+	unsigned char digits[5 * 256];
+	size_t i, k, run;
+
+	assert(st != NULL);
+	assert(a != NULL);
+
+	while (groups > 0) {
+		k = groups < sizeof digits / 5 ? groups : sizeof digits / 5;
+
+		a85_digits(digits, p, k);
+
+		/* "!!!!!" comes only from zero groups */
+		for (i = 0; i < k; i += run) {
+			for (run = 0; i + run < k && memcmp(digits + 5 * (i + run), "!!!!!", 5) != 0; run++)
+				;
+
+			if (run > 0) {
+				if (!a85_put(st, a, digits + 5 * i, 5 * run)) {
+					return false;
+				}
+				continue;
+			}
+
+			if (!a85_put(st, a, (const unsigned char *) "z", 1)) {
+				return false;
+			}
+			run = 1;
+		}
+
+		p      += 4 * k;
+		groups -= k;
+	}
+
+	return true;
+}
+
+static bool
+a85_enc_init(struct filter_stage *st)
+{
+	struct a85_enc *a;
+
+	assert(st != NULL);
+
+	a = malloc(sizeof *a);
+	if (a == NULL) {
+		return false;
+	}
+
+	a->npend = 0;
+	a->col   = 0;
+	a->n     = 0;
+
+	st->state = a;
+
+	return true;
+}
+
+static bool
+a85_enc_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct a85_enc *a;
+	size_t k;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	a = st->state;
+
+	if (a->npend > 0) {
+		k = 4 - a->npend < n ? 4 - a->npend : n;
+		memcpy(a->pend + a->npend, s, k);
+		a->npend += k;
+		s += k;
+		n -= k;
+
+		if (a->npend < 4) {
+			return true;
+		}
+
+		if (!a85_groups(st, a, a->pend, 1)) {
+			return false;
+		}
+
+		a->npend = 0;
+	}
+
+	if (!a85_groups(st, a, s, n / 4)) {
+		return false;
+	}
+
+	memcpy(a->pend, s + n / 4 * 4, n % 4);
+	a->npend = n % 4;
+
+	return true;
+}
+
+static bool
+a85_enc_finish(struct filter_stage *st)
+{
+	unsigned char digits[5];
+	struct a85_enc *a;
+
+	assert(st != NULL);
+
+	a = st->state;
+
+	/* the final partial group is never 'z' */
+	if (a->npend > 0) {
+		memset(a->pend + a->npend, 0, 4 - a->npend);
+		a85_digits_scalar(digits, a->pend, 1);
+
+		if (!a85_put(st, a, digits, a->npend + 1)) {
+			return false;
+		}
+	}
+
+	/* EOD may go past the line length; it isn't split */
+	if (sizeof a->out - a->n < 2 && !a85_flush(st, a->out, &a->n)) {
+		return false;
+	}
+
+	memcpy(a->out + a->n, "~>", 2);
+	a->n += 2;
+
+	return a85_flush(st, a->out, &a->n);
+}
+
+static void
+a85_fini(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	free(st->state);
+}
+
+struct a85_dec {
+	uint32_t v;
+	unsigned ndigits;
+	bool tilde; /* seen '~' of "~>" */
+	bool eod;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+static bool
+a85_dec_init(struct filter_stage *st)
+{
+	struct a85_dec *a;
+
+	assert(st != NULL);
+
+	a = malloc(sizeof *a);
+	if (a == NULL) {
+		return false;
+	}
+
+	a->v       = 0;
+	a->ndigits = 0;
+	a->tilde   = false;
+	a->eod     = false;
+	a->n       = 0;
+
+	st->state = a;
+
+	return true;
+}
+
+static bool
+a85_dec_group(struct filter_stage *st, struct a85_dec *a, size_t len)
+{
+	assert(st != NULL);
+	assert(a != NULL);
+	assert(len <= 4);
+
+	if (sizeof a->out - a->n < 4 && !a85_flush(st, a->out, &a->n)) {
+		return false;
+	}
+
+	a->out[a->n++] = a->v >> 24;
+	if (len > 1) a->out[a->n++] = a->v >> 16;
+	if (len > 2) a->out[a->n++] = a->v >> 8;
+	if (len > 3) a->out[a->n++] = a->v;
+
+	a->v       = 0;
+	a->ndigits = 0;
+
+	return true;
+}
+
+static bool
+a85_dec_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct a85_dec *a;
+	size_t i;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	a = st->state;
+
+	for (i = 0; i < n && !a->eod; i++) {
+		unsigned char c = s[i];
+
+		if (a->tilde) {
+			if (c != '>') {
+				errno = EINVAL;
+				return false;
+			}
+
+			a->eod = true;
+			break;
+		}
+
+		if (c >= '!' && c <= 'u') {
+			uint64_t v;
+
+			v = (uint64_t) a->v * 85 + (c - '!');
+			if (v > UINT32_MAX) {
+				errno = EINVAL;
+				return false;
+			}
+
+			a->v = v;
+
+			if (++a->ndigits == 5 && !a85_dec_group(st, a, 4)) {
+				return false;
+			}
+
+			continue;
+		}
+
+		switch (c) {
+		case 'z':
+			if (a->ndigits != 0) {
+				errno = EINVAL;
+				return false;
+			}
+
+			if (!a85_dec_group(st, a, 4)) {
+				return false;
+			}
+			continue;
+
+		case '~':
+			a->tilde = true;
+			continue;
+
+		/* ISO PDF 2.0 7.4.3 "White-space characters shall be ignored." */
+		case '\0': case '\t': case '\n': case '\f': case '\r': case ' ':
+			continue;
+
+		default:
+			errno = EINVAL;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool
+a85_dec_finish(struct filter_stage *st)
+{
+	struct a85_dec *a;
+	unsigned k;
+
+	assert(st != NULL);
+
+	a = st->state;
+
+	/* a partial final group is padded with 'u' */
+	if (a->ndigits == 1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (a->ndigits > 1) {
+		k = a->ndigits;
+
+		while (a->ndigits < 5) {
+			uint64_t v = (uint64_t) a->v * 85 + 84;
+			if (v > UINT32_MAX) {
+				errno = EINVAL;
+				return false;
+			}
+			a->v = v;
+			a->ndigits++;
+		}
+
+		if (!a85_dec_group(st, a, k - 1)) {
+			return false;
+		}
+	}
+
+	return a85_flush(st, a->out, &a->n);
+}
+
+const struct filter_ops a85_enc = {
+	a85_enc_init, a85_enc_update, a85_enc_finish, a85_fini
+};
+
+const struct filter_ops a85_dec = {
+	a85_dec_init, a85_dec_update, a85_dec_finish, a85_fini
+};
+
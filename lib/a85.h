@@ -0,0 +1,28 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_A85_INTERNAL_H
+#define LIBQDF_A85_INTERNAL_H
+
+/* Output line length, not counting the newline */
+#define A85_LINE 75
+
+extern const struct filter_ops a85_enc;
+extern const struct filter_ops a85_dec;
+
+/*
+ * Base-85 digits for n whole groups of four bytes, most significant first,
+ * as five offsets from '!' per group. No 'z' substitution is made here.
+ */
+void
+a85_digits(unsigned char *dst, const unsigned char *src, size_t n);
+
+/* Portable version, for reference */
+void
+a85_digits_scalar(unsigned char *dst, const unsigned char *src, size_t n);
+
+#endif
+
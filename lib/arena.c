@@ -0,0 +1,199 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <qdf/arena.h>
+
+/* Whatever the platform aligns most strictly */
+union align {
+	long double ld;
+	uintmax_t u;
+	void *p;
+	void (*f)(void);
+};
+
+struct qdf_arena_block {
+	struct qdf_arena_block *prev;
+	size_t size; /* bytes in data[] */
+	size_t n;    /* bytes used */
+	union align data[];
+};
+
+static size_t
+round_up(size_t n)
+{
+	return (n + sizeof (union align) - 1) / sizeof (union align) * sizeof (union align);
+}
+
+void
+qdf_arena_init(struct qdf_arena *a, size_t blocksz)
+{
+	assert(a != NULL);
+
+	a->block   = NULL;
+	a->spare   = NULL;
+	a->blocksz = round_up(blocksz == 0 ? QDF_ARENA_BLOCKSZ : blocksz);
+}
+
+static struct qdf_arena_block *
+block_new(struct qdf_arena *a, size_t n)
+{
+	struct qdf_arena_block *b;
+	size_t size;
+
+	assert(a != NULL);
+
+	if (a->spare != NULL && n <= a->spare->size) {
+		b = a->spare;
+		a->spare = b->prev;
+		return b;
+	}
+
+	size = n > a->blocksz ? n : a->blocksz;
+
+	b = malloc(sizeof *b + size);
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->size = size;
+
+	return b;
+}
+
+void *
+qdf_arena_alloc(struct qdf_arena *a, size_t n)
+{
+	struct qdf_arena_block *b;
+	void *p;
+
+	assert(a != NULL);
+
+	/* so that every allocation has an address of its own */
+	if (n == 0) {
+		n = 1;
+	}
+
+	if (n > SIZE_MAX - sizeof (union align) - sizeof *b) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	n = round_up(n);
+
+	b = a->block;
+
+	if (b == NULL || b->size - b->n < n) {
+		b = block_new(a, n);
+		if (b == NULL) {
+			return NULL;
+		}
+
+		b->prev  = a->block;
+		b->n     = 0;
+		a->block = b;
+	}
+
+	p = (unsigned char *) b->data + b->n;
+	b->n += n;
+
+	return p;
+}
+
+void *
+qdf_arena_calloc(struct qdf_arena *a, size_t n, size_t size)
+{
+	void *p;
+
+	assert(a != NULL);
+
+	if (size != 0 && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	p = qdf_arena_alloc(a, n * size);
+	if (p == NULL) {
+		return NULL;
+	}
+
+	memset(p, 0, n * size);
+
+	return p;
+}
+
+struct qdf_arena_mark
+qdf_arena_mark(const struct qdf_arena *a)
+{
+	struct qdf_arena_mark m;
+
+	assert(a != NULL);
+
+	m.block = a->block;
+	m.n     = a->block != NULL ? a->block->n : 0;
+
+	return m;
+}
+
+void
+qdf_arena_release(struct qdf_arena *a, struct qdf_arena_mark m)
+{
+	struct qdf_arena_block *b;
+
+	assert(a != NULL);
+
+	while (a->block != m.block) {
+		assert(a->block != NULL);
+
+		b = a->block;
+		a->block = b->prev;
+
+		/* blocks made for one large allocation aren't worth keeping */
+		if (b->size != a->blocksz) {
+			free(b);
+			continue;
+		}
+
+		b->prev  = a->spare;
+		a->spare = b;
+	}
+
+	if (a->block != NULL) {
+		assert(m.n <= a->block->n);
+		a->block->n = m.n;
+	}
+}
+
+void
+qdf_arena_reset(struct qdf_arena *a)
+{
+	assert(a != NULL);
+
+	qdf_arena_release(a, (struct qdf_arena_mark) { NULL, 0 });
+}
+
+void
+qdf_arena_fini(struct qdf_arena *a)
+{
+	struct qdf_arena_block *b;
+
+	assert(a != NULL);
+
+	qdf_arena_reset(a);
+
+	while (a->spare != NULL) {
+		b = a->spare;
+		a->spare = b->prev;
+		free(b);
+	}
+}
+
@@ -0,0 +1,568 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+/*
+ * Content hashes for qdf_doc_put(). Objects are hashed by structure rather
+ * than by their printed form, so that streams needn't be encoded to be
+ * compared. Dictionaries are hashed without regard to the order of their
+ * entries, as ISO PDF 2.0 7.3.7 gives them no order.
+ */
+
+/* for getentropy(3) */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+#include <qdf/source.h>
+#include <qdf/arena.h>
+
+#include "filter.h"
+#include "source.h"
+#include "dedup.h"
+
+#define DEDUP_INITIAL 256
+
+struct dedup_entry {
+	struct dedup_hash h;
+	unsigned id; /* 0 for an empty slot */
+};
+
+struct qdf_dedup {
+	uint64_t k[2]; /* secret, so that collisions can't be chosen ahead */
+	size_t size; /* a power of two */
+	size_t n;
+	struct dedup_entry *e;
+};
+
+/*
+ * SipHash-2-4 with 128-bit output. Bytes are consumed eight at a time,
+ * with the remainder held over, so that the result doesn't depend on
+ * how the input is split.
+ */
+struct state {
+	const uint64_t *k;
+	uint64_t v[4];
+	uint64_t len;
+	unsigned char tail[8];
+	size_t n;
+};
+
+/* These tag each kind of value, so that different kinds never run together */
+enum tag {
+	TAG_NULL = 1,
+	TAG_BOOL,
+	TAG_INT,
+	TAG_SIZE,
+	TAG_REAL,
+	TAG_STRING,
+	TAG_BIN,
+	TAG_NAME,
+	TAG_ARRAY,
+	TAG_DICT,
+	TAG_STREAM,
+	TAG_FILTER,
+	TAG_REF
+};
+
+static uint64_t
+rotl(uint64_t v, unsigned r)
+{
+	return v << r | v >> (64 - r);
+}
+
+static uint64_t
+load(const unsigned char *p)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+
+	for (i = 7; i >= 0; i--) {
+		v = v << 8 | p[i];
+	}
+
+	return v;
+}
+
+static void
+rounds(uint64_t v[4], unsigned n)
+{
+	assert(v != NULL);
+
+	while (n-- > 0) {
+		v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+		v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+		v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+		v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+	}
+}
+
+static void
+block(uint64_t v[4], uint64_t m)
+{
+	v[3] ^= m;
+	rounds(v, 2);
+	v[0] ^= m;
+}
+
+static void
+state_init(struct state *s, const uint64_t *k)
+{
+	assert(s != NULL);
+	assert(k != NULL);
+
+	s->k    = k;
+	s->v[0] = k[0] ^ 0x736f6d6570736575ULL;
+	s->v[1] = k[1] ^ 0x646f72616e646f6dULL ^ 0xee;
+	s->v[2] = k[0] ^ 0x6c7967656e657261ULL;
+	s->v[3] = k[1] ^ 0x7465646279746573ULL;
+	s->len  = 0;
+	s->n    = 0;
+}
+
+static void
+state_put(struct state *s, const void *p, size_t n)
+{
+	const unsigned char *q = p;
+	size_t k;
+
+	assert(s != NULL);
+	assert(p != NULL || n == 0);
+
+	s->len += n;
+
+	if (s->n > 0) {
+		k = sizeof s->tail - s->n;
+		if (k > n) {
+			k = n;
+		}
+
+		memcpy(s->tail + s->n, q, k);
+		s->n += k;
+		q    += k;
+		n    -= k;
+
+		if (s->n < sizeof s->tail) {
+			return;
+		}
+
+		block(s->v, load(s->tail));
+		s->n = 0;
+	}
+
+	for ( ; n >= 8; q += 8, n -= 8) {
+		block(s->v, load(q));
+	}
+
+	memcpy(s->tail, q, n);
+	s->n = n;
+}
+
+static void
+state_word(struct state *s, uint64_t v)
+{
+	unsigned char b[8];
+	int i;
+
+	assert(s != NULL);
+
+	for (i = 0; i < 8; i++) {
+		b[i] = v >> (8 * i);
+	}
+
+	state_put(s, b, sizeof b);
+}
+
+/* Prefixed by its length, so that adjacent strings can't run together */
+static void
+state_data(struct state *s, const void *p, size_t n)
+{
+	assert(s != NULL);
+
+	state_word(s, n);
+	state_put(s, p, n);
+}
+
+static struct dedup_hash
+state_end(struct state *s)
+{
+	struct dedup_hash h;
+	uint64_t v[4], b;
+	size_t i;
+
+	assert(s != NULL);
+
+	for (i = s->n; i < sizeof s->tail; i++) {
+		s->tail[i] = 0;
+	}
+
+	memcpy(v, s->v, sizeof v);
+
+	b = load(s->tail) | s->len << 56;
+	block(v, b);
+
+	v[2] ^= 0xee;
+	rounds(v, 4);
+	h.a = v[0] ^ v[1] ^ v[2] ^ v[3];
+
+	v[1] ^= 0xdd;
+	rounds(v, 4);
+	h.b = v[0] ^ v[1] ^ v[2] ^ v[3];
+
+	return h;
+}
+
+static bool
+emit_state(void *opaque, const void *p, size_t n)
+{
+	state_put(opaque, p, n);
+
+	return true;
+}
+
+static bool
+hash_object(struct state *s, struct qdf_arena *arena, const struct qdf_object *o);
+
+static bool
+hash_dict(struct state *s, struct qdf_arena *arena, const struct qdf_dict *d)
+{
+	struct dedup_hash sum, eh;
+	struct state es;
+	size_t i, n;
+
+	assert(s != NULL);
+	assert(d != NULL);
+
+	sum.a = 0;
+	sum.b = 0;
+	n = 0;
+
+	/*
+	 * Each entry is hashed alone, and the results are summed, which
+	 * doesn't depend on their order. Null entries are skipped, as for
+	 * printing; ISO PDF 2.0 7.3.7 treats them as absent.
+	 */
+	for (i = 0; i < d->n; i++) {
+		if (d->e[i].o.type == QDF_TYPE_NULL) {
+			continue;
+		}
+
+		state_init(&es, s->k);
+		state_data(&es, d->e[i].name, strlen(d->e[i].name));
+
+		if (!hash_object(&es, arena, &d->e[i].o)) {
+			return false;
+		}
+
+		eh = state_end(&es);
+
+		sum.a += eh.a;
+		sum.b += eh.b;
+		n++;
+	}
+
+	state_word(s, TAG_DICT);
+	state_word(s, n);
+	state_word(s, sum.a);
+	state_word(s, sum.b);
+
+	return true;
+}
+
+static bool
+hash_stream(struct state *s, struct qdf_arena *arena, const struct qdf_stream *st)
+{
+	struct qdf_entry e[QDF_PARAMS_MAX];
+	struct qdf_object params;
+	struct dedup_hash dh;
+	struct state ds;
+	size_t i;
+
+	assert(s != NULL);
+	assert(st != NULL);
+
+	state_word(s, TAG_STREAM);
+	state_word(s, st->encoded);
+	state_word(s, st->filters.n);
+
+	/* by what's written to /DecodeParms, so default values compare equal */
+	for (i = 0; i < st->filters.n; i++) {
+		state_word(s, TAG_FILTER);
+		state_word(s, st->filters.a[i].type);
+
+		params = qdf_filter_to_object(&st->filters.a[i], e);
+
+		if (!hash_object(s, arena, &params)) {
+			return false;
+		}
+	}
+
+	/* the data goes by itself, with the same result for a source as in memory */
+	state_init(&ds, s->k);
+
+	if (st->src != NULL) {
+		if (!source_pump(st->src, arena, emit_state, &ds)) {
+			return false;
+		}
+	} else {
+		state_put(&ds, st->data.p, st->data.n);
+	}
+
+	dh = state_end(&ds);
+
+	state_word(s, dh.a);
+	state_word(s, dh.b);
+
+	return true;
+}
+
+static bool
+hash_object(struct state *s, struct qdf_arena *arena, const struct qdf_object *o)
+{
+	uint64_t v;
+	size_t i;
+
+	assert(s != NULL);
+	assert(o != NULL);
+
+	switch (o->type) {
+	case QDF_TYPE_NULL:
+		state_word(s, TAG_NULL);
+		return true;
+
+	case QDF_TYPE_BOOL:
+		state_word(s, TAG_BOOL);
+		state_word(s, o->u.v);
+		return true;
+
+	case QDF_TYPE_INT:
+		state_word(s, TAG_INT);
+		state_word(s, (uint64_t) (int64_t) o->u.i);
+		return true;
+
+	case QDF_TYPE_SIZE:
+		state_word(s, TAG_SIZE);
+		state_word(s, o->u.z);
+		return true;
+
+	case QDF_TYPE_REAL:
+		assert(sizeof v == sizeof o->u.n);
+		memcpy(&v, &o->u.n, sizeof v);
+		state_word(s, TAG_REAL);
+		state_word(s, v);
+		return true;
+
+	/* these print the same */
+	case QDF_TYPE_STRING:
+		state_word(s, TAG_STRING);
+		state_data(s, o->u.s, strlen(o->u.s));
+		return true;
+
+	case QDF_TYPE_STRING_N:
+		state_word(s, TAG_STRING);
+		state_data(s, o->u.data.p, o->u.data.n);
+		return true;
+
+	case QDF_TYPE_BIN:
+		state_word(s, TAG_BIN);
+		state_data(s, o->u.data.p, o->u.data.n);
+		return true;
+
+	case QDF_TYPE_NAME:
+		state_word(s, TAG_NAME);
+		state_data(s, o->u.name, strlen(o->u.name));
+		return true;
+
+	case QDF_TYPE_REF:
+		state_word(s, TAG_REF);
+		state_word(s, (uint64_t) o->u.ref.id << 32 | o->u.ref.gen);
+		return true;
+
+	case QDF_TYPE_ARRAY:
+		state_word(s, TAG_ARRAY);
+		state_word(s, o->u.a.n);
+
+		for (i = 0; i < o->u.a.n; i++) {
+			if (!hash_object(s, arena, &o->u.a.o[i])) {
+				return false;
+			}
+		}
+
+		return true;
+
+	case QDF_TYPE_DICT:
+		return hash_dict(s, arena, &o->u.d);
+
+	case QDF_TYPE_STREAM:
+		return hash_stream(s, arena, &o->u.st);
+
+	default:
+		assert(!"unreached");
+		errno = EINVAL;
+		return false;
+	}
+}
+
+bool
+dedup_hashable(const struct qdf_object *o)
+{
+	assert(o != NULL);
+
+	/* ISO PDF 2.0 7.3.8.1 "All streams shall be indirect objects", so only the top level */
+	if (o->type != QDF_TYPE_STREAM || o->u.st.src == NULL) {
+		return true;
+	}
+
+	return o->u.st.src->type != QDF_SOURCE_READ;
+}
+
+bool
+dedup_hash_object(const struct qdf_dedup *d, const struct qdf_object *o,
+	struct qdf_arena *arena, struct dedup_hash *h)
+{
+	struct state s;
+
+	assert(d != NULL);
+	assert(o != NULL);
+	assert(h != NULL);
+	assert(dedup_hashable(o));
+
+	state_init(&s, d->k);
+
+	if (!hash_object(&s, arena, o)) {
+		return false;
+	}
+
+	*h = state_end(&s);
+
+	return true;
+}
+
+unsigned
+dedup_find(const struct qdf_dedup *d, const struct dedup_hash *h)
+{
+	size_t i;
+
+	assert(d != NULL);
+	assert(h != NULL);
+
+	for (i = h->a & (d->size - 1); d->e[i].id != 0; i = (i + 1) & (d->size - 1)) {
+		if (d->e[i].h.a == h->a && d->e[i].h.b == h->b) {
+			return d->e[i].id;
+		}
+	}
+
+	return 0;
+}
+
+static void
+insert(struct dedup_entry *e, size_t size, const struct dedup_hash *h, unsigned id)
+{
+	size_t i;
+
+	assert(e != NULL);
+	assert(h != NULL);
+	assert(id != 0);
+
+	for (i = h->a & (size - 1); e[i].id != 0; i = (i + 1) & (size - 1))
+		;
+
+	e[i].h  = *h;
+	e[i].id = id;
+}
+
+bool
+dedup_reserve(struct qdf_dedup **d)
+{
+	struct dedup_entry *e;
+	size_t size, i;
+
+	assert(d != NULL);
+
+	if (*d == NULL) {
+		*d = malloc(sizeof **d);
+		if (*d == NULL) {
+			return false;
+		}
+
+		if (-1 == getentropy((*d)->k, sizeof (*d)->k)) {
+			free(*d);
+			*d = NULL;
+			return false;
+		}
+
+		(*d)->e = calloc(DEDUP_INITIAL, sizeof *(*d)->e);
+		if ((*d)->e == NULL) {
+			free(*d);
+			*d = NULL;
+			return false;
+		}
+
+		(*d)->size = DEDUP_INITIAL;
+		(*d)->n    = 0;
+	}
+
+	/* kept at most half full, so that probes stay short */
+	if ((*d)->n + 1 > (*d)->size / 2) {
+		size = (*d)->size * 2;
+
+		e = calloc(size, sizeof *e);
+		if (e == NULL) {
+			return false;
+		}
+
+		for (i = 0; i < (*d)->size; i++) {
+			if ((*d)->e[i].id != 0) {
+				insert(e, size, &(*d)->e[i].h, (*d)->e[i].id);
+			}
+		}
+
+		free((*d)->e);
+		(*d)->e    = e;
+		(*d)->size = size;
+	}
+
+	return true;
+}
+
+void
+dedup_add(struct qdf_dedup *d, const struct dedup_hash *h, unsigned id)
+{
+	assert(d != NULL);
+	assert(h != NULL);
+	assert(id != 0);
+	assert(d->n + 1 <= d->size / 2);
+
+	insert(d->e, d->size, h, id);
+	d->n++;
+}
+
+void
+dedup_free(struct qdf_dedup *d)
+{
+	if (d == NULL) {
+		return;
+	}
+
+	free(d->e);
+	free(d);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_DEDUP_INTERNAL_H
+#define LIBQDF_DEDUP_INTERNAL_H
+
+struct qdf_dedup;
+
+/*
+ * A 128-bit SipHash, keyed at random per table. Objects are taken as
+ * equal when their hashes match; without the key, nobody can construct
+ * two objects which collide, and by chance it's far less likely to go
+ * wrong than anything else here.
+ */
+struct dedup_hash {
+	uint64_t a;
+	uint64_t b;
+};
+
+/*
+ * Whether o can be hashed without consuming it. A stream read from a
+ * callback can be read only once, and so it can't be.
+ */
+bool
+dedup_hashable(const struct qdf_object *o);
+
+/*
+ * Hashes o under d's key. Returns false with errno set, if reading a
+ * stream's source fails. The arena is for reading sources.
+ */
+bool
+dedup_hash_object(const struct qdf_dedup *d, const struct qdf_object *o,
+	struct qdf_arena *arena, struct dedup_hash *h);
+
+/* Returns the id recorded for h, or 0 */
+unsigned
+dedup_find(const struct qdf_dedup *d, const struct dedup_hash *h);
+
+/*
+ * Allocates and keys *d as needed, and makes room for one dedup_add(),
+ * so that an id can be recorded after its object has been written.
+ */
+bool
+dedup_reserve(struct qdf_dedup **d);
+
+void
+dedup_add(struct qdf_dedup *d, const struct dedup_hash *h, unsigned id);
+
+void
+dedup_free(struct qdf_dedup *d);
+
+#endif
+
@@ -0,0 +1,1231 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/arena.h>
+#include <qdf/sink.h>
+#include <qdf/print.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+#include <qdf/source.h>
+#include <qdf/doc.h>
+
+#include "filter.h"
+#include "token.h"
+#include "sink.h"
+#include "fmt.h"
+#include "doc.h"
+#include "lin.h"
+#include "dedup.h"
+#include "source.h"
+
+/* for C99 compound literals */
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
+#define DOC_IDS_INITIAL 64
+
+/*
+ * Objects per object stream. A reader must decompress the whole stream
+ * to get at any one object, so this is kept modest.
+ */
+#define OBJSTM_MAX 100
+
+/* ISO PDF 2.0 7.5.8.3 t18 */
+enum xref_type {
+	XREF_FREE       = 0,
+	XREF_OFFSET     = 1,
+	XREF_COMPRESSED = 2
+};
+
+/*
+ * ISO PDF 2.0 7.5.7 Objects are printed to memory as they're defined,
+ * and the stream is printed once it's full, prefixed by the pairs of
+ * object number and offset which index it.
+ */
+struct qdf_objstm {
+	unsigned id;
+	size_t n;
+	unsigned ids[OBJSTM_MAX];
+	size_t offs[OBJSTM_MAX];
+
+	struct qdf_sink sink;
+	struct filter_buf buf;
+};
+
+static bool
+defined(const struct qdf_xref *x)
+{
+	assert(x != NULL);
+
+	return x->off != 0 || x->stm != 0;
+}
+
+/* Defined here, or inherited from an earlier section */
+static bool
+known(const struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+
+	if (id == 0 || id >= doc->next) {
+		return false;
+	}
+
+	return id < doc->start || defined(&doc->x[id]);
+}
+
+/*
+ * Whether id has an entry in this cross-reference section. For an update,
+ * that's just the objects defined here and the ids allocated here.
+ */
+static bool
+present(const struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+	assert(id < doc->next);
+
+	return id == 0 || id >= doc->start || defined(&doc->x[id]);
+}
+
+/*
+ * ISO PDF 2.0 7.5.4 Finds the next subsection, a run of consecutive ids
+ * with entries, from *first onwards. Returns its length, or 0 at the end.
+ */
+static unsigned
+subsection(const struct qdf_doc *doc, unsigned *first)
+{
+	unsigned i;
+
+	assert(doc != NULL);
+	assert(first != NULL);
+
+	for (i = *first; i < doc->next && !present(doc, i); i++)
+		;
+
+	*first = i;
+
+	for ( ; i < doc->next && present(doc, i); i++)
+		;
+
+	return i - *first;
+}
+
+static bool
+packing(const struct qdf_doc *doc)
+{
+	assert(doc != NULL);
+
+	return doc->objstm && doc->ver >= QDF_VER_1_5 && doc->lin == NULL;
+}
+
+bool
+doc_mem_write(void *opaque, const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	assert(opaque != NULL);
+	assert(iov != NULL);
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!filter_collect(opaque, iov[i].iov_base, iov[i].iov_len)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool
+doc_init(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver,
+	uint64_t prev, unsigned start)
+{
+	size_t size;
+
+	assert(doc != NULL);
+	assert(sink != NULL);
+	assert(start > 0);
+
+	size = start < DOC_IDS_INITIAL ? DOC_IDS_INITIAL : start;
+
+	/* id 0 is never allocated; it heads the free list */
+	doc->x = calloc(size, sizeof *doc->x);
+	if (doc->x == NULL) {
+		return false;
+	}
+
+	doc->sink    = sink;
+	doc->ver     = ver;
+	doc->root    = 0;
+	doc->info    = 0;
+	doc->id.p    = NULL;
+	doc->id.n    = 0;
+	doc->objstm  = ver >= QDF_VER_1_5;
+	doc->prev    = prev;
+	doc->start   = start;
+	doc->head    = 0;
+	doc->next    = start;
+	doc->size    = size;
+	doc->pending = NULL;
+	doc->part    = QDF_LIN_OTHER;
+	doc->lin     = NULL;
+	doc->dedup   = NULL;
+
+	return true;
+}
+
+bool
+qdf_doc_init(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver)
+{
+	assert(doc != NULL);
+	assert(sink != NULL);
+
+	if (!doc_init(doc, sink, ver, 0, 1)) {
+		return false;
+	}
+
+	qdf_print_token(sink, & (struct token) { TOK_VER, .u.ver = ver });
+
+	return true;
+}
+
+bool
+qdf_doc_init_update(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver,
+	uint64_t len, uint64_t prev, unsigned size, unsigned head)
+{
+	assert(doc != NULL);
+	assert(sink != NULL);
+	assert(qdf_sink_offset(sink) == 0);
+
+	if (size == 0 || prev >= len || head >= size) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (!doc_init(doc, sink, ver, prev, size)) {
+		return false;
+	}
+
+	doc->head = head;
+
+	/* offsets count from the start of the file, not of the update */
+	sink->written = len;
+
+	return true;
+}
+
+bool
+qdf_doc_init_linear(struct qdf_doc *doc, struct qdf_sink *sink, enum qdf_version ver,
+	int spill)
+{
+	assert(doc != NULL);
+	assert(sink != NULL);
+	assert(qdf_sink_offset(sink) == 0);
+
+	if (spill == -1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (!doc_init(doc, sink, ver, 0, 1)) {
+		return false;
+	}
+
+	doc->objstm = false;
+
+	if (!lin_init(doc, spill)) {
+		free(doc->x);
+		doc->x = NULL;
+		return false;
+	}
+
+	/* so that no object is at offset 0 in the spill, which reads as undefined */
+	qdf_print_token(doc->sink, & (struct token) { TOK_VER, .u.ver = ver });
+
+	return true;
+}
+
+bool
+qdf_doc_page(struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+
+	if (doc->lin == NULL) {
+		return true;
+	}
+
+	return lin_page(doc, id);
+}
+
+unsigned
+qdf_doc_alloc(struct qdf_doc *doc)
+{
+	struct qdf_xref *tmp;
+	size_t size;
+
+	assert(doc != NULL);
+	assert(doc->x != NULL);
+
+	if (doc->next == doc->size) {
+		/* ISO PDF 2.0 Annex C.2 t53 "Largest object number" 8388607 */
+		if (doc->size > 8388607 / 2) {
+			errno = ERANGE;
+			return 0;
+		}
+
+		size = doc->size * 2;
+
+		tmp = realloc(doc->x, size * sizeof *doc->x);
+		if (tmp == NULL) {
+			return 0;
+		}
+
+		memset(tmp + doc->size, 0, (size - doc->size) * sizeof *tmp);
+
+		doc->x    = tmp;
+		doc->size = size;
+	}
+
+	return doc->next++;
+}
+
+static bool
+doc_check(const struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+
+	if (id == 0 || id >= doc->next || defined(&doc->x[id])) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
+/* Records the offset for id, which is where the next token begins */
+static bool
+doc_mark(struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+
+	if (!doc_check(doc, id)) {
+		return false;
+	}
+
+	if (!doc->sink->bol) {
+		qdf_print_token(doc->sink, & (struct token) { TOK_BR });
+	}
+
+	doc->x[id].off = qdf_sink_offset(doc->sink);
+
+	if (doc->lin != NULL && !lin_begin(doc, id)) {
+		doc->x[id].off = 0;
+		return false;
+	}
+
+	return true;
+}
+
+/* qdf_print_object() has no way to report a stream's errors */
+static bool
+doc_def_stream(struct qdf_doc *doc, unsigned id,
+	const struct token *extra, size_t extran,
+	const struct qdf_stream *st)
+{
+	const unsigned gen = 0;
+
+	assert(doc != NULL);
+	assert(st != NULL);
+
+	qdf_print_token(doc->sink, & (struct token) { TOK_DEF_OPEN, .u.ref = { id, gen } });
+
+	if (!qdf_print_stream_with(doc->sink, extra, extran, st)) {
+		return false;
+	}
+
+	qdf_print_token(doc->sink, & (struct token) { TOK_DEF_CLOSE });
+
+	return true;
+}
+
+/*
+ * Whether a stream is better defined through the stream writer. A source
+ * with filters to apply, or of unknown length, would otherwise be held
+ * whole once encoded, for its direct /Length.
+ */
+static bool
+doc_streamed(const struct qdf_stream *st)
+{
+	size_t n;
+
+	assert(st != NULL);
+
+	if (st->src == NULL || st->encoded) {
+		return false;
+	}
+
+	return st->filters.n > 0 || !source_length(st->src, &n);
+}
+
+/* Encoded as it's read, with an indirect /Length */
+static bool
+doc_def_source(struct qdf_doc *doc, unsigned id, const struct qdf_stream *st)
+{
+	struct qdf_stream_writer w;
+
+	assert(doc != NULL);
+	assert(st != NULL);
+	assert(st->src != NULL);
+
+	if (!qdf_doc_stream_begin(doc, &w, id, &st->filters)) {
+		return false;
+	}
+
+	if (!qdf_stream_write_source(&w, st->src)) {
+		(void) qdf_stream_close(&w);
+		return false;
+	}
+
+	return qdf_doc_stream_end(doc, &w);
+}
+
+static void
+objstm_free(struct qdf_objstm *os)
+{
+	assert(os != NULL);
+
+	(void) qdf_sink_fini(&os->sink);
+	free(os->buf.p);
+	free(os);
+}
+
+static bool
+objstm_open(struct qdf_doc *doc)
+{
+	struct qdf_objstm *os;
+
+	assert(doc != NULL);
+	assert(doc->pending == NULL);
+
+	os = malloc(sizeof *os);
+	if (os == NULL) {
+		return false;
+	}
+
+	os->buf.p    = NULL;
+	os->buf.n    = 0;
+	os->buf.size = 0;
+
+	if (!qdf_sink_init(&os->sink, NULL, 0, doc_mem_write, &os->buf)) {
+		free(os);
+		return false;
+	}
+
+	os->sink.mode      = doc->sink->mode;
+	os->sink.precision = doc->sink->precision;
+
+	/* allocated now, so that its objects' entries can refer to it */
+	os->id = qdf_doc_alloc(doc);
+	if (os->id == 0) {
+		objstm_free(os);
+		return false;
+	}
+
+	os->n = 0;
+
+	doc->pending = os;
+
+	return true;
+}
+
+static bool
+objstm_flush(struct qdf_doc *doc)
+{
+	struct filter_buf hb = { NULL, 0, 0 };
+	struct qdf_objstm *os;
+	struct qdf_sink h;
+	struct qdf_filter f;
+	struct iovec iov[2];
+	size_t i;
+	bool r;
+
+	assert(doc != NULL);
+	assert(doc->pending != NULL);
+
+	os = doc->pending;
+	doc->pending = NULL;
+
+	r = false;
+
+	if (!qdf_sink_flush(&os->sink)) {
+		goto done;
+	}
+
+	if (!qdf_sink_init(&h, NULL, QDF_SINK_MIN, doc_mem_write, &hb)) {
+		goto done;
+	}
+
+	/*
+	 * ISO PDF 2.0 7.5.7 "N pairs of integers separated by white space,
+	 * where the first integer in each pair shall represent the object
+	 * number of a compressed object and the second integer shall
+	 * represent the byte offset in the decoded stream of that object,
+	 * relative to the first object stored in the object stream"
+	 */
+	for (i = 0; i < os->n; i++) {
+		qdf_print_token(&h, & (struct token) { TOK_SIZE, .u.z = os->ids[i]  });
+		qdf_print_token(&h, & (struct token) { TOK_SIZE, .u.z = os->offs[i] });
+	}
+
+	qdf_print_token(&h, & (struct token) { TOK_BR });
+
+	if (!qdf_sink_fini(&h)) {
+		goto done;
+	}
+
+	iov[0].iov_base = hb.p;
+	iov[0].iov_len  = hb.n;
+	iov[1].iov_base = os->buf.p;
+	iov[1].iov_len  = os->buf.n;
+
+	f.type        = QDF_FILTER_FLATE;
+	f.u.lzw_flate = qdf_param_lzw_flate_default;
+	memset(&f.enc, 0, sizeof f.enc);
+
+	const struct token extra[] = {
+		{ TOK_NAME, .u.name = "Type"  }, { TOK_NAME, .u.name = "ObjStm" },
+		{ TOK_NAME, .u.name = "N"     }, { TOK_SIZE, .u.z    = os->n    },
+		{ TOK_NAME, .u.name = "First" }, { TOK_SIZE, .u.z    = hb.n     }
+	};
+
+	if (!doc_mark(doc, os->id)) {
+		goto done;
+	}
+
+	r = doc_def_stream(doc, os->id, extra, sizeof extra / sizeof *extra,
+		& (struct qdf_stream) {
+			.filters = { 1, &f },
+			.src = & (struct qdf_source) { QDF_SOURCE_IOV, .u.iov = { iov, 2 } }
+		});
+
+done:
+
+	free(hb.p);
+	objstm_free(os);
+
+	return r;
+}
+
+/*
+ * ISO PDF 2.0 7.5.7 "The following objects shall not be stored in an
+ * object stream: Stream objects; Objects with a generation number other
+ * than zero; A document's encryption dictionary; An object representing
+ * the value of the Length entry in an object stream dictionary".
+ * Nothing here is encrypted, and the object stream's /Length is direct.
+ */
+static bool
+objstm_add(struct qdf_doc *doc, unsigned id, const struct qdf_object *o)
+{
+	struct qdf_objstm *os;
+
+	assert(doc != NULL);
+	assert(o != NULL);
+	assert(o->type != QDF_TYPE_STREAM);
+
+	if (doc->pending == NULL && !objstm_open(doc)) {
+		return false;
+	}
+
+	os = doc->pending;
+
+	os->ids[os->n]  = id;
+	os->offs[os->n] = qdf_sink_offset(&os->sink);
+
+	qdf_print_object(&os->sink, o);
+	qdf_print_token(&os->sink, & (struct token) { TOK_BR });
+
+	doc->x[id].stm   = os->id;
+	doc->x[id].index = os->n;
+
+	os->n++;
+
+	if (os->n == OBJSTM_MAX) {
+		return objstm_flush(doc);
+	}
+
+	return true;
+}
+
+bool
+qdf_doc_def(struct qdf_doc *doc, unsigned id, const struct qdf_object *o)
+{
+	assert(doc != NULL);
+	assert(o != NULL);
+
+	if (o->type == QDF_TYPE_STREAM && doc_streamed(&o->u.st)) {
+		return doc_def_source(doc, id, &o->u.st);
+	}
+
+	if (o->type == QDF_TYPE_STREAM) {
+		if (!doc_mark(doc, id)) {
+			return false;
+		}
+
+		if (!doc_def_stream(doc, id, NULL, 0, &o->u.st)) {
+			return false;
+		}
+
+		if (doc->lin != NULL) {
+			lin_end(doc);
+		}
+
+		return true;
+	}
+
+	if (packing(doc)) {
+		if (!doc_check(doc, id)) {
+			return false;
+		}
+
+		return objstm_add(doc, id, o);
+	}
+
+	if (!doc_mark(doc, id)) {
+		return false;
+	}
+
+	qdf_print_def(doc->sink, id, o);
+
+	if (doc->lin != NULL) {
+		lin_end(doc);
+	}
+
+	return true;
+}
+
+unsigned
+qdf_doc_put(struct qdf_doc *doc, const struct qdf_object *o)
+{
+	struct dedup_hash h;
+	unsigned id;
+
+	assert(doc != NULL);
+	assert(o != NULL);
+
+	if (!dedup_hashable(o)) {
+		id = qdf_doc_alloc(doc);
+		if (id == 0) {
+			return 0;
+		}
+
+		return qdf_doc_def(doc, id, o) ? id : 0;
+	}
+
+	/* before anything is written, so that no id is lost if this fails */
+	if (!dedup_reserve(&doc->dedup)) {
+		return 0;
+	}
+
+	if (!dedup_hash_object(doc->dedup, o, &doc->sink->arena, &h)) {
+		return 0;
+	}
+
+	id = dedup_find(doc->dedup, &h);
+	if (id != 0) {
+		if (doc->lin != NULL) {
+			lin_share(doc, id);
+		}
+
+		return id;
+	}
+
+	id = qdf_doc_alloc(doc);
+	if (id == 0) {
+		return 0;
+	}
+
+	if (!qdf_doc_def(doc, id, o)) {
+		return 0;
+	}
+
+	dedup_add(doc->dedup, &h, id);
+
+	return id;
+}
+
+bool
+qdf_doc_stream_begin(struct qdf_doc *doc, struct qdf_stream_writer *w,
+	unsigned id, const struct qdf_filter_array *filters)
+{
+	unsigned length_id;
+
+	assert(doc != NULL);
+	assert(w != NULL);
+	assert(filters != NULL);
+
+	length_id = qdf_doc_alloc(doc);
+	if (length_id == 0) {
+		return false;
+	}
+
+	if (!doc_mark(doc, id)) {
+		return false;
+	}
+
+	return qdf_stream_begin(w, doc->sink, id, length_id, filters);
+}
+
+bool
+qdf_doc_stream_end(struct qdf_doc *doc, struct qdf_stream_writer *w)
+{
+	assert(doc != NULL);
+	assert(w != NULL);
+
+	if (!qdf_stream_close(w)) {
+		return false;
+	}
+
+	if (doc->lin != NULL) {
+		lin_end(doc);
+	}
+
+	return qdf_doc_def(doc, w->length_id, & (struct qdf_object) { QDF_TYPE_SIZE, .u.z = w->length });
+}
+
+/*
+ * The fields for id's entry, common to the table and the stream.
+ *
+ * ISO PDF 2.0 7.5.4 Free entries form a linked list, each giving the
+ * number of the next free object, headed by object 0 and ending at 0.
+ * The next free id is found by resuming the search from *scan,
+ * so that the whole table takes one pass. Only ids allocated here
+ * can be free; inherited ids were defined by an earlier section.
+ */
+static enum xref_type
+xref_fields(const struct qdf_doc *doc, unsigned id, unsigned *scan,
+	uint64_t *f2, unsigned *f3)
+{
+	const struct qdf_xref *x;
+	unsigned i;
+
+	assert(doc != NULL);
+	assert(scan != NULL);
+	assert(f2 != NULL);
+	assert(f3 != NULL);
+
+	x = &doc->x[id];
+
+	if (id != 0 && x->off != 0) {
+		*f2 = x->off;
+		*f3 = 0;
+		return XREF_OFFSET;
+	}
+
+	if (id != 0 && x->stm != 0) {
+		*f2 = x->stm;
+		*f3 = x->index;
+		return XREF_COMPRESSED;
+	}
+
+	i = *scan > id ? *scan : id + 1;
+
+	if (i < doc->start) {
+		i = doc->start;
+	}
+
+	while (i < doc->next && defined(&doc->x[i])) {
+		i++;
+	}
+
+	*scan = i;
+
+	*f2 = i < doc->next ? i : doc->head;
+	*f3 = 0;
+	return XREF_FREE;
+}
+
+static uint64_t
+fnv(uint64_t h, uint64_t v)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof v; i++) {
+		h = (h ^ (v & 0xff)) * 0x100000001b3ULL;
+		v >>= 8;
+	}
+
+	return h;
+}
+
+/*
+ * FNV-1a over the object locations, in two lanes. The file identifier need
+ * only be unlikely to collide; ISO PDF 2.0 14.4 suggests a digest of
+ * whatever identifies the file.
+ */
+void
+doc_hash(const struct qdf_doc *doc, uint64_t end, unsigned char id[16])
+{
+	uint64_t h[2] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+	const struct qdf_xref *x;
+	unsigned i;
+	int k;
+
+	assert(doc != NULL);
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < doc->next; i++) {
+			x = &doc->x[i];
+
+			h[k] = fnv(h[k], x->off);
+			h[k] = fnv(h[k], (uint64_t) x->stm << 32 | x->index);
+		}
+
+		h[k] = fnv(h[k], end);
+	}
+
+	for (i = 0; i < 8; i++) {
+		id[i]     = h[0] >> (56 - 8 * i);
+		id[i + 8] = h[1] >> (56 - 8 * i);
+	}
+}
+
+#define TRAILER_TOKENS 13
+
+/*
+ * ISO PDF 2.0 7.5.5 t15 Entries in the file trailer dictionary,
+ * which 7.5.8.2 has a cross-reference stream's dict carry too.
+ */
+static size_t
+trailer_tokens(const struct qdf_doc *doc, const unsigned char id[16],
+	struct token t[TRAILER_TOKENS])
+{
+	const unsigned gen = 0;
+	size_t k;
+
+	assert(doc != NULL);
+	assert(id != NULL);
+	assert(t != NULL);
+
+	k = 0;
+
+	t[k++] = (struct token) { TOK_NAME, .u.name = "Size" };
+	t[k++] = (struct token) { TOK_SIZE, .u.z    = doc->next };
+
+	t[k++] = (struct token) { TOK_NAME, .u.name = "Root" };
+	t[k++] = (struct token) { TOK_REF,  .u.ref  = { doc->root, gen } };
+
+	if (doc->info != 0) {
+		t[k++] = (struct token) { TOK_NAME, .u.name = "Info" };
+		t[k++] = (struct token) { TOK_REF,  .u.ref  = { doc->info, gen } };
+	}
+
+	if (doc->prev != 0) {
+		t[k++] = (struct token) { TOK_NAME, .u.name = "Prev" };
+		t[k++] = (struct token) { TOK_SIZE, .u.z    = doc->prev };
+	}
+
+	/*
+	 * ISO PDF 2.0 14.4 "The first byte string shall be a permanent
+	 * identifier ... The second byte string shall be a changing
+	 * identifier", the same as the first for a file written anew.
+	 */
+	t[k++] = (struct token) { TOK_NAME, .u.name = "ID" };
+	t[k++] = (struct token) { TOK_ARRAY_OPEN };
+	if (doc->id.n > 0) {
+		t[k++] = (struct token) { TOK_BIN, .u.data = doc->id };
+	} else {
+		t[k++] = (struct token) { TOK_BIN, .u.data = { id, 16 } };
+	}
+	t[k++] = (struct token) { TOK_BIN, .u.data = { id, 16 } };
+	t[k++] = (struct token) { TOK_ARRAY_CLOSE };
+
+	assert(k <= TRAILER_TOKENS);
+
+	return k;
+}
+
+/* Zero-padded, as xref fields are fixed-width */
+static void
+fmt_pad(unsigned char *p, uint64_t v, size_t width)
+{
+	size_t i;
+
+	for (i = width; i-- > 0; ) {
+		p[i] = '0' + v % 10;
+		v /= 10;
+	}
+}
+
+/*
+ * ISO PDF 2.0 7.5.4 "Each entry shall be exactly 20 bytes long,
+ * including the end-of-line marker."
+ */
+void
+doc_xref_entry(struct qdf_sink *sink, uint64_t n, unsigned gen, char type)
+{
+	unsigned char *p;
+
+	assert(sink != NULL);
+
+	p = sink_reserve(sink, 20);
+
+	fmt_pad(p, n, 10);
+	p[10] = ' ';
+	fmt_pad(p + 11, gen, 5);
+	p[16] = ' ';
+	p[17] = type;
+	p[18] = '\r';
+	p[19] = '\n';
+
+	sink_commit(sink, 20);
+}
+
+void
+doc_startxref(struct qdf_sink *sink, uint64_t xref)
+{
+	unsigned char *q;
+	size_t n;
+
+	assert(sink != NULL);
+
+	if (!sink->bol) {
+		qdf_print_token(sink, & (struct token) { TOK_BR });
+	}
+
+	/* ISO PDF 2.0 7.5.5 */
+	sink_puts(sink, "startxref\n");
+
+	q = sink_reserve(sink, FMT_INT_MAX + 1);
+	n = fmt_uint((char *) q, xref);
+	q[n++] = '\n';
+	sink_commit(sink, n);
+
+	qdf_print_token(sink, & (struct token) { TOK_EOF });
+}
+
+static bool
+print_xref_table(struct qdf_doc *doc)
+{
+	struct token t[TRAILER_TOKENS];
+	unsigned char id[16];
+	enum xref_type type;
+	unsigned i, scan;
+	unsigned first, n;
+	uint64_t xref;
+	uint64_t f2;
+	unsigned f3;
+	size_t k, tn;
+
+	assert(doc != NULL);
+
+	xref = qdf_sink_offset(doc->sink);
+
+	sink_puts(doc->sink, "xref\n");
+
+	scan = 0;
+
+	for (first = 0; (n = subsection(doc, &first)) > 0; first += n) {
+		qdf_print_token(doc->sink, & (struct token) { TOK_SIZE, .u.z = first });
+		qdf_print_token(doc->sink, & (struct token) { TOK_SIZE, .u.z = n });
+		qdf_print_token(doc->sink, & (struct token) { TOK_BR });
+
+		for (i = first; i < first + n; i++) {
+			type = xref_fields(doc, i, &scan, &f2, &f3);
+
+			assert(type != XREF_COMPRESSED);
+
+			/* ISO PDF 2.0 7.5.4 "the first entry ... shall have a generation number of 65,535" */
+			doc_xref_entry(doc->sink, f2, i == 0 ? 65535 : f3,
+				type == XREF_FREE ? 'f' : 'n');
+		}
+	}
+
+	sink_puts(doc->sink, "trailer\n");
+	doc->sink->bol = true;
+
+	doc_hash(doc, xref, id);
+	tn = trailer_tokens(doc, id, t);
+
+	qdf_print_token(doc->sink, & (struct token) { TOK_DICT_OPEN });
+
+	for (k = 0; k < tn; k++) {
+		qdf_print_token(doc->sink, &t[k]);
+	}
+
+	qdf_print_token(doc->sink, & (struct token) { TOK_DICT_CLOSE });
+
+	doc_startxref(doc->sink, xref);
+
+	return true;
+}
+
+/* The fewest bytes which hold v */
+static unsigned
+width(uint64_t v)
+{
+	unsigned w;
+
+	for (w = 0; v > 0; w++) {
+		v >>= 8;
+	}
+
+	return w;
+}
+
+static void
+put_be(unsigned char *p, uint64_t v, unsigned w)
+{
+	while (w-- > 0) {
+		p[w] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+/*
+ * ISO PDF 2.0 7.5.8 A cross-reference stream, in place of both the table
+ * and the trailer. Each field is as narrow as its largest value allows,
+ * and rows are the same width, so the PNG Up predictor leaves mostly
+ * zeros for Flate where offsets climb steadily.
+ */
+static bool
+print_xref_stream(struct qdf_doc *doc)
+{
+	struct qdf_arena_mark m;
+	struct token *t;
+	unsigned char id[16];
+	enum xref_type type;
+	struct qdf_filter f;
+	unsigned char *data, *p;
+	unsigned i, scan, xid;
+	unsigned first, n;
+	size_t entries, subs;
+	uint64_t max2, f2;
+	unsigned max3, f3;
+	unsigned w[3];
+	size_t k, row;
+	bool r;
+
+	assert(doc != NULL);
+
+	/* the stream is itself an object, with an entry of its own */
+	xid = qdf_doc_alloc(doc);
+	if (xid == 0) {
+		return false;
+	}
+
+	if (!doc_mark(doc, xid)) {
+		return false;
+	}
+
+	max2    = 0;
+	max3    = 0;
+	scan    = 0;
+	entries = 0;
+	subs    = 0;
+
+	for (first = 0; (n = subsection(doc, &first)) > 0; first += n) {
+		for (i = first; i < first + n; i++) {
+			(void) xref_fields(doc, i, &scan, &f2, &f3);
+
+			if (f2 > max2) {
+				max2 = f2;
+			}
+
+			if (f3 > max3) {
+				max3 = f3;
+			}
+		}
+
+		entries += n;
+		subs++;
+	}
+
+	/*
+	 * ISO PDF 2.0 7.5.8.2 t17 /W "A value of zero for an element in the
+	 * W array indicates that the corresponding field shall not be present
+	 * in the stream, and the default value shall be used". Object 0's
+	 * generation of 65535 is a convention of the table (7.5.4), which
+	 * would cost a byte or two per entry here; it's written as 0.
+	 */
+	w[0] = 1;
+	w[1] = width(max2);
+	w[2] = width(max3);
+
+	row = w[0] + w[1] + w[2];
+
+	/* /Type, /W, and /Index with a pair per subsection */
+	m = qdf_arena_mark(&doc->sink->arena);
+
+	t    = qdf_arena_calloc(&doc->sink->arena, TRAILER_TOKENS + 8 + 3 + subs * 2, sizeof *t);
+	data = qdf_arena_alloc(&doc->sink->arena, entries * row);
+	if (t == NULL || data == NULL) {
+		qdf_arena_release(&doc->sink->arena, m);
+		return false;
+	}
+
+	p    = data;
+	scan = 0;
+
+	for (first = 0; (n = subsection(doc, &first)) > 0; first += n) {
+		for (i = first; i < first + n; i++) {
+			type = xref_fields(doc, i, &scan, &f2, &f3);
+
+			put_be(p, type, w[0]); p += w[0];
+			put_be(p, f2,   w[1]); p += w[1];
+			put_be(p, f3,   w[2]); p += w[2];
+		}
+	}
+
+	f.type        = QDF_FILTER_FLATE;
+	f.u.lzw_flate = qdf_param_lzw_flate_default;
+	memset(&f.enc, 0, sizeof f.enc);
+
+	/* ISO PDF 2.0 7.4.4.4 t9 "PNG prediction ... PNG Up on all rows" */
+	f.u.lzw_flate.predictor = 12;
+	f.u.lzw_flate.columns   = row;
+
+	k = 0;
+
+	t[k++] = (struct token) { TOK_NAME, .u.name = "Type" };
+	t[k++] = (struct token) { TOK_NAME, .u.name = "XRef" };
+	t[k++] = (struct token) { TOK_NAME, .u.name = "W" };
+	t[k++] = (struct token) { TOK_ARRAY_OPEN };
+	t[k++] = (struct token) { TOK_SIZE, .u.z = w[0] };
+	t[k++] = (struct token) { TOK_SIZE, .u.z = w[1] };
+	t[k++] = (struct token) { TOK_SIZE, .u.z = w[2] };
+	t[k++] = (struct token) { TOK_ARRAY_CLOSE };
+
+	/* ISO PDF 2.0 7.5.8.2 t17 /Index "Default value: [0 Size]" */
+	if (entries != doc->next) {
+		t[k++] = (struct token) { TOK_NAME, .u.name = "Index" };
+		t[k++] = (struct token) { TOK_ARRAY_OPEN };
+
+		for (first = 0; (n = subsection(doc, &first)) > 0; first += n) {
+			t[k++] = (struct token) { TOK_SIZE, .u.z = first };
+			t[k++] = (struct token) { TOK_SIZE, .u.z = n };
+		}
+
+		t[k++] = (struct token) { TOK_ARRAY_CLOSE };
+	}
+
+	doc_hash(doc, doc->x[xid].off, id);
+	k += trailer_tokens(doc, id, t + k);
+
+	r = doc_def_stream(doc, xid, t, k,
+		& (struct qdf_stream) {
+			.data    = { data, entries * row },
+			.filters = { 1, &f }
+		});
+
+	qdf_arena_release(&doc->sink->arena, m);
+
+	if (!r) {
+		return false;
+	}
+
+	doc_startxref(doc->sink, doc->x[xid].off);
+
+	return true;
+}
+
+bool
+qdf_doc_end(struct qdf_doc *doc)
+{
+	uint64_t max;
+	unsigned i;
+	bool stream;
+	bool r;
+
+	assert(doc != NULL);
+	assert(doc->x != NULL);
+
+	r = false;
+
+	if (doc->pending != NULL && !objstm_flush(doc)) {
+		goto done;
+	}
+
+	if (!known(doc, doc->root) || (doc->info != 0 && !known(doc, doc->info))) {
+		errno = EINVAL;
+		goto done;
+	}
+
+	if (doc->lin != NULL) {
+		r = lin_write(doc);
+		goto done;
+	}
+
+	if (!doc->sink->bol) {
+		qdf_print_token(doc->sink, & (struct token) { TOK_BR });
+	}
+
+	max = 0;
+
+	for (i = 1; i < doc->next; i++) {
+		if (doc->x[i].off > max) {
+			max = doc->x[i].off;
+		}
+	}
+
+	/*
+	 * ISO PDF 2.0 7.5.8.1 Cross-reference streams have no such limit,
+	 * but readers of earlier versions won't know them.
+	 */
+	stream = packing(doc);
+
+	if (!stream && max > XREF_OFFSET_MAX) {
+		if (doc->ver < QDF_VER_1_5) {
+			errno = EOVERFLOW;
+			goto done;
+		}
+
+		stream = true;
+	}
+
+	if (stream) {
+		r = print_xref_stream(doc);
+	} else {
+		r = print_xref_table(doc);
+	}
+
+	if (!r) {
+		goto done;
+	}
+
+	r = qdf_sink_flush(doc->sink);
+
+done:
+
+	if (doc->pending != NULL) {
+		objstm_free(doc->pending);
+		doc->pending = NULL;
+	}
+
+	if (doc->lin != NULL) {
+		lin_fini(doc);
+	}
+
+	dedup_free(doc->dedup);
+	doc->dedup = NULL;
+
+	free(doc->x);
+	doc->x = NULL;
+
+	return r;
+}
+
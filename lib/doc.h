@@ -0,0 +1,27 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_DOC_INTERNAL_H
+#define LIBQDF_DOC_INTERNAL_H
+
+/* ISO PDF 2.0 7.5.4 "a 10-digit byte offset" */
+#define XREF_OFFSET_MAX 9999999999ULL
+
+/* A sink's write callback which collects output in a struct filter_buf */
+bool
+doc_mem_write(void *opaque, const struct iovec *iov, int iovcnt);
+
+void
+doc_hash(const struct qdf_doc *doc, uint64_t end, unsigned char id[16]);
+
+void
+doc_xref_entry(struct qdf_sink *sink, uint64_t n, unsigned gen, char type);
+
+void
+doc_startxref(struct qdf_sink *sink, uint64_t xref);
+
+#endif
+
@@ -8,8 +8,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <errno.h>
 
+#include <zlib.h>
+
 #include <qdf/version.h>
 #include <qdf/types.h>
 #include <qdf/params.h>
@@ -17,6 +20,12 @@
 
 #include "params.h"
 #include "filter.h"
+#include "hex.h"
+#include "flate.h"
+#include "lzw.h"
+#include "a85.h"
+#include "rle.h"
+#include "predict.h"
 
 const char *
 qdf_filter_name(enum qdf_filter_type type)
@@ -95,26 +104,629 @@ omit:
 	return (struct qdf_object) { .type = QDF_TYPE_NULL };
 }
 
+bool
+filter_collect(void *opaque, const void *p, size_t n)
+{
+	struct filter_buf *b = opaque;
+
+	assert(b != NULL);
+	assert(p != NULL || n == 0);
+
+	if (n > b->size - b->n) {
+		unsigned char *tmp;
+		size_t size;
+
+		size = b->size;
+		do {
+			if (size > SIZE_MAX / 2) {
+				errno = ENOMEM;
+				return false;
+			}
+
+			size = size == 0 ? 4096 : size * 2;
+		} while (n > size - b->n);
+
+		tmp = realloc(b->p, size);
+		if (tmp == NULL) {
+			return false;
+		}
+
+		b->p    = tmp;
+		b->size = size;
+	}
+
+	memcpy(b->p + b->n, p, n);
+	b->n += n;
+
+	return true;
+}
+
+static bool
+ascii_hex_update(struct filter_stage *st, const void *p, size_t n)
+{
+	char buf[FILTER_CHUNK];
+	size_t k;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	while (n > 0) {
+		k = n < sizeof buf / 2 ? n : sizeof buf / 2;
+
+		hex_encode(buf, p, k);
+
+		if (!st->emit(st->opaque, buf, k * 2)) {
+			return false;
+		}
+
+		p = (const unsigned char *) p + k;
+		n -= k;
+	}
+
+	return true;
+}
+
+static bool
+ascii_hex_finish(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	/* ISO PDF 2.0 7.4.2 "A GREATER-THAN SIGN (3Eh) indicates EOD." */
+	return st->emit(st->opaque, ">", 1);
+}
+
+struct ascii_hex_dec {
+	int hi; /* the first digit of a pair, or -1 */
+	bool eod;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+static bool
+ascii_hex_dec_init(struct filter_stage *st)
+{
+	struct ascii_hex_dec *h;
+
+	assert(st != NULL);
+
+	h = malloc(sizeof *h);
+	if (h == NULL) {
+		return false;
+	}
+
+	h->hi  = -1;
+	h->eod = false;
+	h->n   = 0;
+
+	st->state = h;
+
+	return true;
+}
+
+static bool
+ascii_hex_dec_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct ascii_hex_dec *h;
+	size_t i;
+	int v;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	h = st->state;
+
+	for (i = 0; i < n && !h->eod; i++) {
+		/* unbroken runs of pairs are the common case */
+		while (h->hi == -1 && i + 1 < n && h->n < sizeof h->out
+			&& hex_values[s[i]] >= 0 && hex_values[s[i + 1]] >= 0)
+		{
+			h->out[h->n++] = hex_values[s[i]] << 4 | hex_values[s[i + 1]];
+			i += 2;
+		}
+
+		if (h->n == sizeof h->out) {
+			if (!st->emit(st->opaque, h->out, h->n)) {
+				return false;
+			}
+
+			h->n = 0;
+		}
+
+		if (i == n) {
+			break;
+		}
+
+		v = hex_values[s[i]];
+
+		if (v >= 0) {
+			if (h->hi == -1) {
+				h->hi = v;
+			} else {
+				h->out[h->n++] = h->hi << 4 | v;
+				h->hi = -1;
+			}
+			continue;
+		}
+
+		if (v == -2) {
+			continue;
+		}
+
+		if (s[i] != '>') {
+			errno = EINVAL;
+			return false;
+		}
+
+		h->eod = true;
+	}
+
+	return true;
+}
+
+static bool
+ascii_hex_dec_finish(struct filter_stage *st)
+{
+	struct ascii_hex_dec *h;
+
+	assert(st != NULL);
+
+	h = st->state;
+
+	/*
+	 * ISO PDF 2.0 7.4.2 "If the filter encounters the EOD marker after
+	 * reading an odd number of hexadecimal digits, it shall behave as if
+	 * a 0 (zero) followed the last digit."
+	 */
+	if (h->hi != -1) {
+		if (h->n == sizeof h->out) {
+			if (!st->emit(st->opaque, h->out, h->n)) {
+				return false;
+			}
+
+			h->n = 0;
+		}
+
+		h->out[h->n++] = h->hi << 4;
+	}
+
+	if (h->n == 0) {
+		return true;
+	}
+
+	return st->emit(st->opaque, h->out, h->n);
+}
+
+static void
+ascii_hex_dec_fini(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	free(st->state);
+}
+
+static bool
+flate_dec_init_stage(struct filter_stage *st)
+{
+	struct flate *fl;
+
+	assert(st != NULL);
+
+	fl = malloc(sizeof *fl);
+	if (fl == NULL) {
+		return false;
+	}
+
+	if (!flate_dec_init(fl)) {
+		free(fl);
+		return false;
+	}
+
+	st->state = fl;
+
+	return true;
+}
+
+static bool
+flate_dec_update_stage(struct filter_stage *st, const void *p, size_t n)
+{
+	assert(st != NULL);
+
+	return flate_dec_update(st->state, p, n, st->emit, st->opaque);
+}
+
+static bool
+flate_dec_finish_stage(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return flate_dec_finish(st->state);
+}
+
+static void
+flate_dec_fini_stage(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	flate_dec_fini(st->state);
+	free(st->state);
+}
+
+static bool
+flate_init(struct filter_stage *st)
+{
+	struct flate *fl;
+
+	assert(st != NULL);
+
+	/* not on the stack; this carries the output chunk */
+	fl = malloc(sizeof *fl);
+	if (fl == NULL) {
+		return false;
+	}
+
+	if (!flate_enc_init(fl, st->f->enc.level)) {
+		free(fl);
+		return false;
+	}
+
+	st->state = fl;
+
+	return true;
+}
+
+static bool
+flate_update(struct filter_stage *st, const void *p, size_t n)
+{
+	assert(st != NULL);
+
+	return flate_enc_update(st->state, p, n, st->emit, st->opaque);
+}
+
+static bool
+flate_finish(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return flate_enc_finish(st->state, st->emit, st->opaque);
+}
+
+static void
+flate_fini(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	flate_enc_fini(st->state);
+	free(st->state);
+}
+
+static bool
+flate_blocks_init_stage(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	st->state = flate_blocks_init(st->f->enc.level, st->f->enc.block, st->f->enc.threads);
+	if (st->state == NULL) {
+		return false;
+	}
+
+	return true;
+}
+
+static bool
+flate_blocks_update_stage(struct filter_stage *st, const void *p, size_t n)
+{
+	assert(st != NULL);
+
+	return flate_blocks_update(st->state, p, n, st->emit, st->opaque);
+}
+
+static bool
+flate_blocks_finish_stage(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return flate_blocks_finish(st->state, st->emit, st->opaque);
+}
+
+static void
+flate_blocks_fini_stage(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	flate_blocks_fini(st->state);
+}
+
+static const struct filter_ops ascii_hex_enc = {
+	NULL, ascii_hex_update, ascii_hex_finish, NULL
+};
+
+static const struct filter_ops ascii_hex_dec = {
+	ascii_hex_dec_init, ascii_hex_dec_update, ascii_hex_dec_finish, ascii_hex_dec_fini
+};
+
+static const struct filter_ops flate_enc = {
+	flate_init, flate_update, flate_finish, flate_fini
+};
+
+static const struct filter_ops flate_blocks_enc = {
+	flate_blocks_init_stage, flate_blocks_update_stage, flate_blocks_finish_stage, flate_blocks_fini_stage
+};
+
+static const struct filter_ops flate_dec = {
+	flate_dec_init_stage, flate_dec_update_stage, flate_dec_finish_stage, flate_dec_fini_stage
+};
+
+static const struct filter_ops *
+encoder(const struct qdf_filter *f)
+{
+	assert(f != NULL);
+
+	switch (f->type) {
+	case QDF_FILTER_ASCII_HEX:
+		return &ascii_hex_enc;
+
+	case QDF_FILTER_ASCII_85:
+		return &a85_enc;
+
+	case QDF_FILTER_LZW:
+		return &lzw_enc;
+
+	case QDF_FILTER_FLATE:
+		if (f->enc.block != 0 || f->enc.threads > 1) {
+			return &flate_blocks_enc;
+		}
+		return &flate_enc;
+
+	case QDF_FILTER_RLE:
+		return &rle_enc;
+
+	default:
+		errno = ENOSYS;
+		return NULL;
+	}
+}
+
+static const struct filter_ops *
+decoder(const struct qdf_filter *f)
+{
+	assert(f != NULL);
+
+	switch (f->type) {
+	case QDF_FILTER_ASCII_HEX:
+		return &ascii_hex_dec;
+
+	case QDF_FILTER_ASCII_85:
+		return &a85_dec;
+
+	case QDF_FILTER_LZW:
+		return &lzw_dec;
+
+	case QDF_FILTER_FLATE:
+		return &flate_dec;
+
+	case QDF_FILTER_RLE:
+		return &rle_dec;
+
+	default:
+		errno = ENOSYS;
+		return NULL;
+	}
+}
+
+/* Output from one stage is input to the next */
+static bool
+stage_emit(void *opaque, const void *p, size_t n)
+{
+	struct filter_stage *next = opaque;
+
+	assert(next != NULL);
+	assert(next->ops != NULL);
+
+	return next->ops->update(next, p, n);
+}
+
+/* Appends a stage for f. ops is NULL where there's none, with errno set */
+static bool
+chain_push(struct qdf_filter_chain *c, const struct qdf_filter *f,
+	const struct filter_ops *ops)
+{
+	struct filter_stage *st;
+
+	assert(c != NULL);
+	assert(f != NULL);
+
+	if (ops == NULL) {
+		return false;
+	}
+
+	st = &c->st[c->n];
+
+	st->f      = f;
+	st->ops    = ops;
+	st->emit   = c->emit;
+	st->opaque = c->opaque;
+	st->state  = NULL;
+
+	if (ops->init != NULL && !ops->init(st)) {
+		return false;
+	}
+
+	/* the previous stage feeds this one */
+	if (c->n > 0) {
+		c->st[c->n - 1].emit   = stage_emit;
+		c->st[c->n - 1].opaque = st;
+	}
+
+	c->n++;
+
+	return true;
+}
+
+static bool
+chain_init(struct qdf_filter_chain *c, const struct qdf_filter_array *a, bool decode,
+	qdf_filter_emit *emit, void *opaque)
+{
+	size_t i, k, n;
+
+	assert(c != NULL);
+	assert(a != NULL);
+	assert(emit != NULL);
+
+	c->n      = 0;
+	c->emit   = emit;
+	c->opaque = opaque;
+	c->st     = NULL;
+
+	if (a->n == 0) {
+		return true;
+	}
+
+	/* a predictor is a stage of its own */
+	n = a->n;
+	for (i = 0; i < a->n; i++) {
+		if (predict_needed(&a->a[i])) {
+			n++;
+		}
+	}
+
+	c->st = calloc(n, sizeof *c->st);
+	if (c->st == NULL) {
+		return false;
+	}
+
+	/*
+	 * ISO PDF 2.0 7.3.8.2 t5 /Filter lists filters in the order they're
+	 * applied for decoding, so the first stage to encode is the last listed.
+	 * A predictor is applied before its filter to encode, and after to decode.
+	 */
+	for (k = 0; k < a->n; k++) {
+		const struct qdf_filter *f;
+
+		if (decode) {
+			f = &a->a[k];
+
+			if (!chain_push(c, f, decoder(f))) {
+				goto error;
+			}
+
+			if (predict_needed(f) && !chain_push(c, f, &predict_dec)) {
+				goto error;
+			}
+		} else {
+			f = &a->a[a->n - 1 - k];
+
+			if (predict_needed(f) && !chain_push(c, f, &predict_enc)) {
+				goto error;
+			}
+
+			if (!chain_push(c, f, encoder(f))) {
+				goto error;
+			}
+		}
+	}
+
+	return true;
+
+error:
+
+	filter_chain_fini(c);
+
+	return false;
+}
+
+bool
+filter_chain_init(struct qdf_filter_chain *c, const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque)
+{
+	return chain_init(c, a, false, emit, opaque);
+}
+
+bool
+filter_chain_init_decode(struct qdf_filter_chain *c, const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque)
+{
+	return chain_init(c, a, true, emit, opaque);
+}
+
+bool
+filter_chain_update(struct qdf_filter_chain *c, const void *p, size_t n)
+{
+	assert(c != NULL);
+	assert(p != NULL || n == 0);
+
+	if (c->n == 0) {
+		return c->emit(c->opaque, p, n);
+	}
+
+	return c->st[0].ops->update(&c->st[0], p, n);
+}
+
+bool
+filter_chain_finish(struct qdf_filter_chain *c)
+{
+	size_t k;
+
+	assert(c != NULL);
+
+	/* each stage's remaining output goes to the next before that finishes */
+	for (k = 0; k < c->n; k++) {
+		if (!c->st[k].ops->finish(&c->st[k])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+filter_chain_fini(struct qdf_filter_chain *c)
+{
+	size_t k;
+
+	assert(c != NULL);
+
+	for (k = 0; k < c->n; k++) {
+		if (c->st[k].ops->fini != NULL) {
+			c->st[k].ops->fini(&c->st[k]);
+		}
+	}
+
+	free(c->st);
+	c->st = NULL;
+	c->n  = 0;
+}
+
 bool
 qdf_filter_encode(const struct qdf_filter *f,
 	const void *in, size_t insz,
 	const void **out, size_t *outsz)
 {
+	struct filter_buf b = { NULL, 0, 0 };
+	struct qdf_filter_chain c;
+
 	assert(f != NULL);
 	assert(in != NULL);
 	assert(out != NULL);
 	assert(outsz != NULL);
 
-	(void) in;
-	(void) insz;
-	(void) out;
-	(void) outsz;
+	if (!filter_chain_init(&c, & (struct qdf_filter_array) { 1, (struct qdf_filter *) f }, filter_collect, &b)) {
+		return false;
+	}
 
-	switch (f->type) {
-	default:
-		errno = ENOSYS;
+	if (!filter_chain_update(&c, in, insz) || !filter_chain_finish(&c)) {
+		filter_chain_fini(&c);
+		free(b.p);
 		return false;
 	}
+
+	filter_chain_fini(&c);
+
+	*out   = b.p;
+	*outsz = b.n;
+
+	return true;
 }
 
 bool
@@ -122,20 +734,155 @@ qdf_filter_decode(const struct qdf_filter *f,
 	const void *in, size_t insz,
 	const void **out, size_t *outsz)
 {
+	struct filter_buf b = { NULL, 0, 0 };
+	struct qdf_filter_chain c;
+
 	assert(f != NULL);
 	assert(in != NULL);
 	assert(out != NULL);
 	assert(outsz != NULL);
 
-	(void) in;
-	(void) insz;
-	(void) out;
-	(void) outsz;
+	if (!filter_chain_init_decode(&c, & (struct qdf_filter_array) { 1, (struct qdf_filter *) f }, filter_collect, &b)) {
+		return false;
+	}
 
-	switch (f->type) {
-	default:
-		errno = ENOSYS;
+	if (!filter_chain_update(&c, in, insz) || !filter_chain_finish(&c)) {
+		filter_chain_fini(&c);
+		free(b.p);
 		return false;
 	}
+
+	filter_chain_fini(&c);
+
+	*out   = b.p;
+	*outsz = b.n;
+
+	return true;
 }
 
+bool
+qdf_filter_decode_stream(const struct qdf_filter_array *a,
+	const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque)
+{
+	struct qdf_filter_chain c;
+
+	assert(a != NULL);
+	assert(in != NULL || n == 0);
+	assert(emit != NULL);
+
+	if (!filter_chain_init_decode(&c, a, emit, opaque)) {
+		return false;
+	}
+
+	if (!filter_chain_update(&c, in, n) || !filter_chain_finish(&c)) {
+		filter_chain_fini(&c);
+		return false;
+	}
+
+	filter_chain_fini(&c);
+
+	return true;
+}
+
+bool
+qdf_filter_decode_begin(struct qdf_filter_decoder *d,
+	const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque)
+{
+	assert(d != NULL);
+	assert(a != NULL);
+	assert(emit != NULL);
+
+	d->chain = malloc(sizeof *d->chain);
+	if (d->chain == NULL) {
+		return false;
+	}
+
+	if (!filter_chain_init_decode(d->chain, a, emit, opaque)) {
+		free(d->chain);
+		d->chain = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+bool
+qdf_filter_decode_update(struct qdf_filter_decoder *d, const void *p, size_t n)
+{
+	assert(d != NULL);
+	assert(d->chain != NULL);
+	assert(p != NULL || n == 0);
+
+	return filter_chain_update(d->chain, p, n);
+}
+
+bool
+qdf_filter_decode_end(struct qdf_filter_decoder *d)
+{
+	bool r;
+
+	assert(d != NULL);
+	assert(d->chain != NULL);
+
+	r = filter_chain_finish(d->chain);
+
+	filter_chain_fini(d->chain);
+	free(d->chain);
+	d->chain = NULL;
+
+	return r;
+}
+
+/* A filter_buf which doesn't grow */
+static bool
+fixed_emit(void *opaque, const void *p, size_t n)
+{
+	struct filter_buf *b = opaque;
+	size_t k;
+
+	assert(b != NULL);
+	assert(p != NULL || n == 0);
+
+	k = n < b->size - b->n ? n : b->size - b->n;
+
+	memcpy(b->p + b->n, p, k);
+	b->n += k;
+
+	if (k < n) {
+		errno = ENOBUFS;
+		return false;
+	}
+
+	return true;
+}
+
+bool
+qdf_filter_decode_buf(const struct qdf_filter_array *a,
+	const void *in, size_t n,
+	void *buf, size_t size, size_t *outsz)
+{
+	struct filter_buf b;
+	bool r;
+
+	assert(a != NULL);
+	assert(in != NULL || n == 0);
+	assert(buf != NULL || size == 0);
+	assert(outsz != NULL);
+
+	/* Flate alone inflates straight into buf */
+	if (a->n == 1 && a->a[0].type == QDF_FILTER_FLATE && !predict_needed(&a->a[0])) {
+		return flate_dec_buf(in, n, buf, size, outsz);
+	}
+
+	b.p    = buf;
+	b.n    = 0;
+	b.size = size;
+
+	r = qdf_filter_decode_stream(a, in, n, fixed_emit, &b);
+
+	*outsz = b.n;
+
+	return r;
+}
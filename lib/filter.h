@@ -7,6 +7,72 @@
 #ifndef LIBQDF_FILTER_INTERNAL_H
 #define LIBQDF_FILTER_INTERNAL_H
 
+/* Working buffer size for stages which format output in place */
+#define FILTER_CHUNK (16 * 1024)
+
+struct filter_stage;
+
+/*
+ * A push-based filter: input is given to update() in chunks of any size,
+ * and output is passed on to the stage's emit() as it is produced, in
+ * bounded chunks. finish() flushes whatever is held and any trailer.
+ * init and fini may be NULL where a filter keeps no state.
+ */
+struct filter_ops {
+	bool (*init)  (struct filter_stage *st);
+	bool (*update)(struct filter_stage *st, const void *p, size_t n);
+	bool (*finish)(struct filter_stage *st);
+	void (*fini)  (struct filter_stage *st);
+};
+
+struct filter_stage {
+	const struct qdf_filter *f;
+	const struct filter_ops *ops;
+	qdf_filter_emit *emit;
+	void *opaque;
+	void *state;
+};
+
+/*
+ * Stages for every filter in a stream's /Filter array, and for their
+ * predictors, each feeding the next, with the last feeding emit().
+ * Only a few chunks are held at once, however much data passes through.
+ */
+struct qdf_filter_chain {
+	size_t n;
+	struct filter_stage *st;
+	qdf_filter_emit *emit;
+	void *opaque;
+};
+
+/* For collecting output whole, with filter_collect() as the emit callback */
+struct filter_buf {
+	unsigned char *p;
+	size_t n;
+	size_t size;
+};
+
+bool
+filter_collect(void *opaque, const void *p, size_t n);
+
+bool
+filter_chain_init(struct qdf_filter_chain *c, const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque);
+
+/* The inverse, taking encoded data in and passing decoded data to emit() */
+bool
+filter_chain_init_decode(struct qdf_filter_chain *c, const struct qdf_filter_array *a,
+	qdf_filter_emit *emit, void *opaque);
+
+bool
+filter_chain_update(struct qdf_filter_chain *c, const void *p, size_t n);
+
+bool
+filter_chain_finish(struct qdf_filter_chain *c);
+
+void
+filter_chain_fini(struct qdf_filter_chain *c);
+
 struct qdf_object
 qdf_filter_to_object(const struct qdf_filter *f, struct qdf_entry e[]);
 
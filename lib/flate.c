@@ -0,0 +1,717 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+
+#include "flate.h"
+
+static void
+zerrno(int r)
+{
+	switch (r) {
+	case Z_MEM_ERROR:     errno = ENOMEM; break;
+	case Z_VERSION_ERROR: errno = ENOTSUP; break;
+	default:              errno = EINVAL; break;
+	}
+}
+
+bool
+flate_enc_init(struct flate *fl, int level)
+{
+	int r;
+
+	assert(fl != NULL);
+
+	if (level == 0) {
+		level = FLATE_LEVEL_DEFAULT;
+	}
+
+	if (level < 1 || level > 9) {
+		errno = EINVAL;
+		return false;
+	}
+
+	memset(&fl->z, 0, sizeof fl->z);
+
+	/* ISO PDF 2.0 7.4.4.1 FlateDecode is the zlib format (RFC 1950) */
+	r = deflateInit(&fl->z, level);
+	if (r != Z_OK) {
+		zerrno(r);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Runs deflate() over whatever input is pending, handing each full
+ * chunk of output to emit() as it's produced.
+ */
+static bool
+pump(struct flate *fl, int flush,
+	qdf_filter_emit *emit, void *opaque)
+{
+	int r;
+
+	assert(fl != NULL);
+	assert(emit != NULL);
+
+	do {
+		fl->z.next_out  = fl->out;
+		fl->z.avail_out = sizeof fl->out;
+
+		r = deflate(&fl->z, flush);
+		if (r == Z_STREAM_ERROR) {
+			zerrno(r);
+			return false;
+		}
+
+		if (sizeof fl->out - fl->z.avail_out > 0) {
+			if (!emit(opaque, fl->out, sizeof fl->out - fl->z.avail_out)) {
+				return false;
+			}
+		}
+	} while (fl->z.avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END));
+
+	return true;
+}
+
+bool
+flate_enc_update(struct flate *fl, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque)
+{
+	const unsigned char *p = in;
+	uInt k;
+
+	assert(fl != NULL);
+	assert(in != NULL || n == 0);
+	assert(emit != NULL);
+
+	/* avail_in is narrower than size_t */
+	while (n > 0) {
+		k = n > UINT_MAX ? UINT_MAX : n;
+
+		fl->z.next_in  = (Bytef *) p;
+		fl->z.avail_in = k;
+
+		if (!pump(fl, Z_NO_FLUSH, emit, opaque)) {
+			return false;
+		}
+
+		assert(fl->z.avail_in == 0);
+
+		p += k;
+		n -= k;
+	}
+
+	return true;
+}
+
+bool
+flate_enc_finish(struct flate *fl,
+	qdf_filter_emit *emit, void *opaque)
+{
+	assert(fl != NULL);
+	assert(emit != NULL);
+
+	fl->z.next_in  = NULL;
+	fl->z.avail_in = 0;
+
+	return pump(fl, Z_FINISH, emit, opaque);
+}
+
+void
+flate_enc_fini(struct flate *fl)
+{
+	assert(fl != NULL);
+
+	(void) deflateEnd(&fl->z);
+}
+
+bool
+flate_dec_init(struct flate *fl)
+{
+	int r;
+
+	assert(fl != NULL);
+
+	memset(&fl->z, 0, sizeof fl->z);
+
+	r = inflateInit(&fl->z);
+	if (r != Z_OK) {
+		zerrno(r);
+		return false;
+	}
+
+	fl->end = false;
+
+	return true;
+}
+
+/*
+ * Anything after the end of the zlib stream is ignored;
+ * some producers pad with whitespace before "endstream".
+ */
+bool
+flate_dec_update(struct flate *fl, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque)
+{
+	const unsigned char *p = in;
+	uInt k;
+	int r;
+
+	assert(fl != NULL);
+	assert(in != NULL || n == 0);
+	assert(emit != NULL);
+
+	while (n > 0 && !fl->end) {
+		k = n > UINT_MAX ? UINT_MAX : n;
+
+		fl->z.next_in  = (Bytef *) p;
+		fl->z.avail_in = k;
+
+		do {
+			fl->z.next_out  = fl->out;
+			fl->z.avail_out = sizeof fl->out;
+
+			r = inflate(&fl->z, Z_NO_FLUSH);
+			if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+				zerrno(r);
+				return false;
+			}
+
+			if (sizeof fl->out - fl->z.avail_out > 0) {
+				if (!emit(opaque, fl->out, sizeof fl->out - fl->z.avail_out)) {
+					return false;
+				}
+			}
+
+			if (r == Z_STREAM_END) {
+				fl->end = true;
+				break;
+			}
+		} while (fl->z.avail_out == 0 || fl->z.avail_in > 0);
+
+		p += k;
+		n -= k;
+	}
+
+	return true;
+}
+
+bool
+flate_dec_finish(struct flate *fl)
+{
+	assert(fl != NULL);
+
+	/* truncated */
+	if (!fl->end) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
+void
+flate_dec_fini(struct flate *fl)
+{
+	assert(fl != NULL);
+
+	(void) inflateEnd(&fl->z);
+}
+
+/*
+ * Decodes whole into buf, without an intermediate chunk. With a /DL
+ * to size buf, this is a single call to inflate().
+ */
+bool
+flate_dec_buf(const void *in, size_t n, void *buf, size_t size, size_t *outsz)
+{
+	size_t inleft, outleft;
+	uInt ai, ao;
+	z_stream z;
+	int r;
+
+	assert(in != NULL || n == 0);
+	assert(buf != NULL || size == 0);
+	assert(outsz != NULL);
+
+	memset(&z, 0, sizeof z);
+
+	r = inflateInit(&z);
+	if (r != Z_OK) {
+		zerrno(r);
+		return false;
+	}
+
+	z.next_in  = (Bytef *) in;
+	z.next_out = buf;
+
+	inleft  = n;
+	outleft = size;
+
+	/*
+	 * avail_in and avail_out are narrower than size_t. Output may still
+	 * be pending after the last input is taken, if avail_out ran out.
+	 */
+	do {
+		ai = inleft  > UINT_MAX ? UINT_MAX : inleft;
+		ao = outleft > UINT_MAX ? UINT_MAX : outleft;
+
+		z.avail_in  = ai;
+		z.avail_out = ao;
+
+		r = inflate(&z, Z_NO_FLUSH);
+
+		inleft  -= ai - z.avail_in;
+		outleft -= ao - z.avail_out;
+	} while (r == Z_OK && (inleft > 0 || (z.avail_out == 0 && outleft > 0)));
+
+	*outsz = size - outleft;
+
+	(void) inflateEnd(&z);
+
+	switch (r) {
+	case Z_STREAM_END:
+		return true;
+
+	/* out of room with more to come, or truncated */
+	case Z_OK:
+	case Z_BUF_ERROR:
+		errno = outleft == 0 ? ENOBUFS : EINVAL;
+		return false;
+
+	default:
+		zerrno(r);
+		return false;
+	}
+}
+
+struct flate_job {
+	const unsigned char *in;
+	size_t n;
+	size_t dict; /* bytes preceding in[] to prime with */
+	bool last;
+	int level;
+
+	unsigned char *out;
+	size_t outn;
+	uLong adler;
+	int err;
+};
+
+struct flate_pool {
+	pthread_mutex_t m;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	struct flate_job *jobs;
+	size_t njobs;
+	size_t next;
+	size_t finished;
+	bool quit;
+};
+
+/*
+ * Each block is raw deflate (no zlib header), flushed to a byte boundary
+ * with Z_SYNC_FLUSH so that blocks can be concatenated as-is. Only the
+ * last block is finished, and so only it has BFINAL set. Priming with the
+ * preceding input means matches can reach back across the block boundary,
+ * as they would for a single deflate() over the whole input.
+ */
+static void
+flate_job_run(struct flate_job *job)
+{
+	z_stream z;
+	int r;
+
+	assert(job != NULL);
+	assert(job->n <= FLATE_BLOCK_MAX);
+
+	job->out  = NULL;
+	job->outn = 0;
+	job->err  = 0;
+
+	job->adler = adler32(adler32(0, NULL, 0), job->in, job->n);
+
+	memset(&z, 0, sizeof z);
+
+	r = deflateInit2(&z, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	if (r != Z_OK) {
+		zerrno(r);
+		job->err = errno;
+		return;
+	}
+
+	if (job->dict > 0) {
+		r = deflateSetDictionary(&z, job->in - job->dict, job->dict);
+		if (r != Z_OK) {
+			zerrno(r);
+			goto error;
+		}
+	}
+
+	/* room for the sync marker and an empty final block, besides the bound */
+	job->outn = deflateBound(&z, job->n) + 16;
+	job->out  = malloc(job->outn);
+	if (job->out == NULL) {
+		goto error;
+	}
+
+	z.next_in   = (Bytef *) job->in;
+	z.avail_in  = job->n;
+	z.next_out  = job->out;
+	z.avail_out = job->outn;
+
+	r = deflate(&z, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (r != (job->last ? Z_STREAM_END : Z_OK) || z.avail_in != 0) {
+		zerrno(Z_BUF_ERROR);
+		goto error;
+	}
+
+	job->outn -= z.avail_out;
+
+	(void) deflateEnd(&z);
+
+	return;
+
+error:
+
+	job->err = errno;
+
+	free(job->out);
+	job->out = NULL;
+
+	(void) deflateEnd(&z);
+}
+
+static void *
+flate_worker(void *opaque)
+{
+	struct flate_pool *pool = opaque;
+	struct flate_job *job;
+
+	assert(pool != NULL);
+
+	pthread_mutex_lock(&pool->m);
+
+	for (;;) {
+		while (pool->next >= pool->njobs && !pool->quit) {
+			pthread_cond_wait(&pool->work, &pool->m);
+		}
+
+		if (pool->quit) {
+			break;
+		}
+
+		job = &pool->jobs[pool->next++];
+
+		pthread_mutex_unlock(&pool->m);
+		flate_job_run(job);
+		pthread_mutex_lock(&pool->m);
+
+		if (++pool->finished == pool->njobs) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->m);
+
+	return NULL;
+}
+
+/* ISO PDF 2.0 7.4.4.1, RFC 1950 2.2 */
+static void
+zlib_header(unsigned char h[2], int level)
+{
+	unsigned flevel;
+
+	flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+
+	h[0] = 0x78; /* deflate, 32 KiB window */
+	h[1] = flevel << 6;
+	h[1] += 31 - (h[0] * 256 + h[1]) % 31;
+}
+
+struct flate_blocks {
+	int level;
+	size_t block;
+	size_t batch; /* blocks per batch */
+	bool header;
+	uLong adler;
+
+	/* recent input kept for priming, then input not yet compressed */
+	unsigned char *buf;
+	size_t hist;
+	size_t have;
+
+	struct flate_job *jobs;
+	struct flate_pool pool;
+	pthread_t *tids;
+	unsigned started;
+};
+
+struct flate_blocks *
+flate_blocks_init(int level, size_t block, unsigned threads)
+{
+	struct flate_blocks *fb;
+	unsigned t;
+
+	if (level == 0) {
+		level = FLATE_LEVEL_DEFAULT;
+	}
+
+	if (block == 0) {
+		block = FLATE_BLOCK_DEFAULT;
+	}
+
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	if (level < 1 || level > 9 || block > FLATE_BLOCK_MAX || threads > FLATE_THREADS_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fb = malloc(sizeof *fb);
+	if (fb == NULL) {
+		return NULL;
+	}
+
+	fb->level  = level;
+	fb->block  = block;
+	fb->header = false;
+	fb->adler  = adler32(0, NULL, 0);
+	fb->hist   = 0;
+	fb->have   = 0;
+
+	/* a few blocks in hand per thread, to bound memory for the outputs */
+	fb->batch = threads * 4;
+
+	fb->buf  = malloc(FLATE_WINDOW + fb->batch * block);
+	fb->jobs = malloc(fb->batch * sizeof *fb->jobs);
+	fb->tids = malloc(threads * sizeof *fb->tids);
+	if (fb->buf == NULL || fb->jobs == NULL || fb->tids == NULL) {
+		free(fb->buf);
+		free(fb->jobs);
+		free(fb->tids);
+		free(fb);
+		return NULL;
+	}
+
+	pthread_mutex_init(&fb->pool.m, NULL);
+	pthread_cond_init(&fb->pool.work, NULL);
+	pthread_cond_init(&fb->pool.done, NULL);
+
+	fb->pool.jobs     = fb->jobs;
+	fb->pool.njobs    = 0;
+	fb->pool.next     = 0;
+	fb->pool.finished = 0;
+	fb->pool.quit     = false;
+
+	/* the calling thread runs jobs itself when there are no others */
+	fb->started = 0;
+	if (threads > 1) {
+		for (t = 0; t < threads; t++) {
+			if (pthread_create(&fb->tids[t], NULL, flate_worker, &fb->pool) != 0) {
+				break;
+			}
+			fb->started++;
+		}
+	}
+
+	return fb;
+}
+
+/*
+ * Compresses everything pending. A block is only compressed as non-final
+ * once more input is known to follow it, so where the block boundaries
+ * fall and which block is last depend only on the input and block size,
+ * and not on the batch size (and so thread count) or how input arrives.
+ */
+static bool
+flate_blocks_run(struct flate_blocks *fb, bool last,
+	qdf_filter_emit *emit, void *opaque)
+{
+	unsigned char h[2];
+	size_t k, i, off, keep;
+	bool ok;
+
+	assert(fb != NULL);
+	assert(emit != NULL);
+
+	if (!fb->header) {
+		zlib_header(h, fb->level);
+		if (!emit(opaque, h, sizeof h)) {
+			return false;
+		}
+
+		fb->header = true;
+	}
+
+	/* empty input is still one (empty, final) block */
+	k   = 0;
+	off = 0;
+	do {
+		struct flate_job *job = &fb->jobs[k++];
+
+		job->in    = fb->buf + fb->hist + off;
+		job->n     = fb->have - off < fb->block ? fb->have - off : fb->block;
+		job->dict  = fb->hist + off < FLATE_WINDOW ? fb->hist + off : FLATE_WINDOW;
+		job->level = fb->level;
+		off += job->n;
+		job->last  = last && off == fb->have;
+	} while (off < fb->have);
+
+	assert(k <= fb->batch);
+
+	if (fb->started > 0) {
+		pthread_mutex_lock(&fb->pool.m);
+		fb->pool.njobs    = k;
+		fb->pool.next     = 0;
+		fb->pool.finished = 0;
+		pthread_cond_broadcast(&fb->pool.work);
+		while (fb->pool.finished < fb->pool.njobs) {
+			pthread_cond_wait(&fb->pool.done, &fb->pool.m);
+		}
+		fb->pool.njobs = 0;
+		fb->pool.next  = 0;
+		pthread_mutex_unlock(&fb->pool.m);
+	} else {
+		for (i = 0; i < k; i++) {
+			flate_job_run(&fb->jobs[i]);
+		}
+	}
+
+	/* emitted in order, whichever thread finished first */
+	ok = true;
+	for (i = 0; i < k; i++) {
+		const struct flate_job *job = &fb->jobs[i];
+
+		if (ok && job->err != 0) {
+			errno = job->err;
+			ok = false;
+		}
+
+		if (ok && !emit(opaque, job->out, job->outn)) {
+			ok = false;
+		}
+
+		if (ok) {
+			fb->adler = adler32_combine(fb->adler, job->adler, job->n);
+		}
+
+		free(job->out);
+	}
+
+	keep = fb->hist + fb->have < FLATE_WINDOW ? fb->hist + fb->have : FLATE_WINDOW;
+	memmove(fb->buf, fb->buf + fb->hist + fb->have - keep, keep);
+	fb->hist = keep;
+	fb->have = 0;
+
+	return ok;
+}
+
+bool
+flate_blocks_update(struct flate_blocks *fb, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque)
+{
+	const unsigned char *p = in;
+	size_t space, k;
+
+	assert(fb != NULL);
+	assert(in != NULL || n == 0);
+	assert(emit != NULL);
+
+	while (n > 0) {
+		space = fb->batch * fb->block - fb->have;
+
+		/* full, and now known not to be the end */
+		if (space == 0) {
+			if (!flate_blocks_run(fb, false, emit, opaque)) {
+				return false;
+			}
+			continue;
+		}
+
+		k = n < space ? n : space;
+		memcpy(fb->buf + fb->hist + fb->have, p, k);
+		fb->have += k;
+
+		p += k;
+		n -= k;
+	}
+
+	return true;
+}
+
+bool
+flate_blocks_finish(struct flate_blocks *fb,
+	qdf_filter_emit *emit, void *opaque)
+{
+	unsigned char h[4];
+
+	assert(fb != NULL);
+	assert(emit != NULL);
+
+	if (!flate_blocks_run(fb, true, emit, opaque)) {
+		return false;
+	}
+
+	h[0] = fb->adler >> 24;
+	h[1] = fb->adler >> 16;
+	h[2] = fb->adler >> 8;
+	h[3] = fb->adler;
+
+	return emit(opaque, h, sizeof h);
+}
+
+void
+flate_blocks_fini(struct flate_blocks *fb)
+{
+	unsigned t;
+
+	if (fb == NULL) {
+		return;
+	}
+
+	if (fb->started > 0) {
+		pthread_mutex_lock(&fb->pool.m);
+		fb->pool.quit = true;
+		pthread_cond_broadcast(&fb->pool.work);
+		pthread_mutex_unlock(&fb->pool.m);
+
+		for (t = 0; t < fb->started; t++) {
+			pthread_join(fb->tids[t], NULL);
+		}
+	}
+
+	pthread_cond_destroy(&fb->pool.done);
+	pthread_cond_destroy(&fb->pool.work);
+	pthread_mutex_destroy(&fb->pool.m);
+
+	free(fb->buf);
+	free(fb->jobs);
+	free(fb->tids);
+	free(fb);
+}
+
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_FLATE_INTERNAL_H
+#define LIBQDF_FLATE_INTERNAL_H
+
+#define FLATE_LEVEL_DEFAULT 6
+
+/* Working buffer for output; this bounds memory per stream, besides zlib's own */
+#define FLATE_CHUNK (16 * 1024)
+
+struct flate {
+	z_stream z;
+	bool end; /* decoding: seen the end of the zlib stream */
+	unsigned char out[FLATE_CHUNK];
+};
+
+#define FLATE_WINDOW        32768
+#define FLATE_BLOCK_DEFAULT (128 * 1024)
+#define FLATE_BLOCK_MAX     (64 * 1024 * 1024)
+#define FLATE_THREADS_MAX   256
+
+bool
+flate_enc_init(struct flate *fl, int level);
+
+bool
+flate_enc_update(struct flate *fl, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque);
+
+bool
+flate_enc_finish(struct flate *fl,
+	qdf_filter_emit *emit, void *opaque);
+
+void
+flate_enc_fini(struct flate *fl);
+
+bool
+flate_dec_init(struct flate *fl);
+
+bool
+flate_dec_update(struct flate *fl, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque);
+
+bool
+flate_dec_finish(struct flate *fl);
+
+void
+flate_dec_fini(struct flate *fl);
+
+bool
+flate_dec_buf(const void *in, size_t n, void *buf, size_t size, size_t *outsz);
+
+/*
+ * Block mode; see struct qdf_filter_enc. Produces a single zlib stream,
+ * from independently compressed raw deflate blocks.
+ */
+struct flate_blocks;
+
+struct flate_blocks *
+flate_blocks_init(int level, size_t block, unsigned threads);
+
+bool
+flate_blocks_update(struct flate_blocks *fb, const void *in, size_t n,
+	qdf_filter_emit *emit, void *opaque);
+
+bool
+flate_blocks_finish(struct flate_blocks *fb,
+	qdf_filter_emit *emit, void *opaque);
+
+void
+flate_blocks_fini(struct flate_blocks *fb);
+
+#endif
+
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <float.h>
+#include <math.h>
+
+#include "fmt.h"
+
+/* Exactly representable as doubles */
+static const double pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,
+	1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+/* 2^53; every double at least this large is an integer */
+#define EXACT_MAX 9007199254740992.0
+
+/* Pairs of decimal digits, indexed by 2 * (0..99) */
+static const char digits2[200 + 1] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static size_t
+count_digits(uintmax_t u)
+{
+	size_t n;
+
+	for (n = 1; ; n += 4, u /= 10000) {
+		if (u < 10)    return n;
+		if (u < 100)   return n + 1;
+		if (u < 1000)  return n + 2;
+		if (u < 10000) return n + 3;
+	}
+}
+
+/*
+ * The length is known up front, so digits are written in place from
+ * the end, two at a time, without reversing afterwards.
+ */
+size_t
+fmt_uint(char *buf, uintmax_t u)
+{
+	size_t n;
+	char *q;
+
+	assert(buf != NULL);
+
+	n = count_digits(u);
+	q = buf + n;
+
+	while (u >= 100) {
+		q -= 2;
+		memcpy(q, digits2 + 2 * (u % 100), 2);
+		u /= 100;
+	}
+
+	if (u >= 10) {
+		q -= 2;
+		memcpy(q, digits2 + 2 * u, 2);
+	} else {
+		*--q = '0' + u;
+	}
+
+	assert(q == buf);
+
+	return n;
+}
+
+size_t
+fmt_int(char *buf, intmax_t i)
+{
+	assert(buf != NULL);
+
+	if (i >= 0) {
+		return fmt_uint(buf, i);
+	}
+
+	/* negated as unsigned, for INTMAX_MIN */
+	buf[0] = '-';
+	return 1 + fmt_uint(buf + 1, -(uintmax_t) i);
+}
+
+/*
+ * Does r / 10^p read back as a?
+ *
+ * With r below 2^53 and p at most 22, both operands are exact and IEEE
+ * division is correctly rounded, so this gives the same double as a
+ * reader parsing the decimal digits would.
+ */
+static bool
+roundtrips(uint64_t r, unsigned p, double a)
+{
+	return (double) r / pow10[p] == a;
+}
+
+/*
+ * ISO PDF 2.0 7.3.3 "A PDF writer shall not use the PostScript language
+ * syntax for numbers with non-decimal radicies (such as 16#FFFE) or in
+ * exponential format (such as 6.02E23)."
+ *
+ * Produces the fewest fractional digits (up to the given precision)
+ * which read back as the same double. Where no such string exists
+ * within the precision, the value is rounded to that many places.
+ * Places are also given up where the digits would not fit in 53 bits,
+ * so values needing 16 or 17 significant digits may lose the last one.
+ * Trailing zeros and a leading zero integer part are omitted,
+ * and integral values have no decimal point.
+ */
+size_t
+fmt_real(char *buf, double n, unsigned precision)
+{
+	uint64_t r, ip;
+	double hi, lo, t;
+	unsigned p;
+	double a;
+	char *q;
+
+	assert(buf != NULL);
+	assert(isfinite(n));
+
+	if (precision > FMT_PRECISION_MAX) {
+		precision = FMT_PRECISION_MAX;
+	}
+
+	q = buf;
+	a = fabs(n);
+
+	if (a >= EXACT_MAX) {
+		if (a < 18446744073709551616.0) {
+			if (signbit(n)) {
+				*q++ = '-';
+			}
+			return q - buf + fmt_uint(q, (uint64_t) a);
+		}
+
+		/* beyond ISO PDF 2.0 Annex C.1's limits for reals anyway */
+		return snprintf(buf, FMT_REAL_MAX, "%.0f", n);
+	}
+
+	/* as many places as keep r exact */
+	p = precision;
+	while (p > 0 && a * pow10[p] >= EXACT_MAX) {
+		p--;
+	}
+
+	/*
+	 * Rounded once, half away from zero. hi + lo is the product exactly,
+	 * and hi - r is exact too, so the comparisons against half see the
+	 * true remainder rather than one already rounded by the product.
+	 */
+	hi = a * pow10[p];
+	lo = fma(a, pow10[p], -hi);
+	r  = (uint64_t) nearbyint(hi);
+	t  = hi - (double) r;
+
+	if (lo >= 0.5 - t) {
+		r++;
+	} else if (lo < -0.5 - t) {
+		r--;
+	}
+
+	/* the product may be an ulp out; look either side for an exact match */
+	if (!roundtrips(r, p, a)) {
+		if (r > 0 && roundtrips(r - 1, p, a)) {
+			r--;
+		} else if (roundtrips(r + 1, p, a)) {
+			r++;
+		}
+	}
+
+	if (roundtrips(r, p, a)) {
+		while (p > 0) {
+			if (r % 10 == 0) {
+				r /= 10;
+				p--;
+				continue;
+			}
+
+			if (!roundtrips((r + 5) / 10, p - 1, a)) {
+				break;
+			}
+
+			r = (r + 5) / 10;
+			p--;
+		}
+	} else {
+		while (p > 0 && r % 10 == 0) {
+			r /= 10;
+			p--;
+		}
+	}
+
+	/* no "-0" */
+	if (r == 0) {
+		*q++ = '0';
+		return q - buf;
+	}
+
+	if (signbit(n)) {
+		*q++ = '-';
+	}
+
+	ip = r / (uint64_t) pow10[p];
+	r  = r % (uint64_t) pow10[p];
+
+	if (ip > 0 || p == 0) {
+		q += fmt_uint(q, ip);
+	}
+
+	if (p > 0) {
+		char tmp[FMT_INT_MAX];
+		size_t k;
+
+		*q++ = '.';
+
+		/* leading zeros after the point */
+		k = fmt_uint(tmp, r);
+		memset(q, '0', p - k);
+		q += p - k;
+		memcpy(q, tmp, k);
+		q += k;
+	}
+
+	return q - buf;
+}
+
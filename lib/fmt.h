@@ -0,0 +1,28 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_FMT_INTERNAL_H
+#define LIBQDF_FMT_INTERNAL_H
+
+/* Enough for any uintmax_t in decimal, with a sign */
+#define FMT_INT_MAX 21
+
+/* Enough for any finite double in fixed notation */
+#define FMT_REAL_MAX (DBL_MAX_10_EXP + 2 + 1 + FMT_PRECISION_MAX)
+
+#define FMT_PRECISION_MAX 17
+
+size_t
+fmt_uint(char *buf, uintmax_t u);
+
+size_t
+fmt_int(char *buf, intmax_t i);
+
+size_t
+fmt_real(char *buf, double n, unsigned precision);
+
+#endif
+
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEX_X86
+#include <immintrin.h>
+#endif
+
+#include "hex.h"
+
+const char hex_pairs[512 + 1] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/*
+ * Hex digit values, either case. -2 for ISO PDF 2.0 7.2.3 whitespace,
+ * which ASCIIHexDecode ignores, and -1 for anything else.
+ */
+const signed char hex_values[256] = {
+	-2, -1, -1, -1, -1, -1, -1, -1, -1, -2, -2, -1, -2, -2, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+void
+hex_encode_scalar(char *dst, const void *src, size_t n)
+{
+	const unsigned char *p = src;
+	size_t i;
+
+	assert(dst != NULL);
+	assert(src != NULL || n == 0);
+
+	for (i = 0; i < n; i++) {
+		memcpy(dst + 2 * i, hex_pairs + 2 * p[i], 2);
+	}
+}
+
+#ifdef HEX_X86
+
+/*
+ * Each nibble n becomes '0' + n, plus ('a' - '0' - 10) where n > 9.
+ * The high and low nibble vectors are then interleaved, high first.
+ */
+
+__attribute__((target("sse2")))
+static void
+hex_encode_sse2(char *dst, const void *src, size_t n)
+{
+	const unsigned char *p = src;
+	const __m128i mask  = _mm_set1_epi8(0x0f);
+	const __m128i nine  = _mm_set1_epi8(9);
+	const __m128i zero  = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i v, hi, lo;
+
+		v  = _mm_loadu_si128((const __m128i *) (p + i));
+		hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		lo = _mm_and_si128(v, mask);
+
+		hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+		_mm_storeu_si128((__m128i *) (dst + 2 * i),      _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+
+	hex_encode_scalar(dst + 2 * i, p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+hex_encode_avx2(char *dst, const void *src, size_t n)
+{
+	const unsigned char *p = src;
+	const __m256i mask  = _mm256_set1_epi8(0x0f);
+	const __m256i nine  = _mm256_set1_epi8(9);
+	const __m256i zero  = _mm256_set1_epi8('0');
+	const __m256i alpha = _mm256_set1_epi8('a' - '0' - 10);
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i v, hi, lo, a, b;
+
+		v  = _mm256_loadu_si256((const __m256i *) (p + i));
+		hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+		lo = _mm256_and_si256(v, mask);
+
+		hi = _mm256_add_epi8(_mm256_add_epi8(hi, zero), _mm256_and_si256(_mm256_cmpgt_epi8(hi, nine), alpha));
+		lo = _mm256_add_epi8(_mm256_add_epi8(lo, zero), _mm256_and_si256(_mm256_cmpgt_epi8(lo, nine), alpha));
+
+		/* unpack works within 128-bit lanes; put the lanes back in order */
+		a = _mm256_unpacklo_epi8(hi, lo);
+		b = _mm256_unpackhi_epi8(hi, lo);
+
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i),      _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *) (dst + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+
+	hex_encode_sse2(dst + 2 * i, p + i, n - i);
+}
+
+/*
+ * Chosen once at load time, before any thread can print, so that the
+ * pointer is never written while it might be read.
+ */
+static void (*hex_encode_impl)(char *dst, const void *src, size_t n) = hex_encode_scalar;
+
+__attribute__((constructor))
+static void
+hex_encode_resolve(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		hex_encode_impl = hex_encode_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		hex_encode_impl = hex_encode_sse2;
+	}
+}
+
+#endif
+
+void
+hex_encode(char *dst, const void *src, size_t n)
+{
+	assert(dst != NULL);
+	assert(src != NULL || n == 0);
+
+#ifdef HEX_X86
+	hex_encode_impl(dst, src, n);
+#else
+	hex_encode_scalar(dst, src, n);
+#endif
+}
+
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_HEX_INTERNAL_H
+#define LIBQDF_HEX_INTERNAL_H
+
+/* Pairs of lowercase hex digits, indexed by 2 * byte */
+extern const char hex_pairs[512 + 1];
+
+/* Digit values, -2 for whitespace, -1 otherwise */
+extern const signed char hex_values[256];
+
+/*
+ * Write 2n lowercase hex digits for the n bytes at src.
+ * No terminator is written.
+ */
+void
+hex_encode(char *dst, const void *src, size_t n);
+
+/* Portable version, for reference */
+void
+hex_encode_scalar(char *dst, const void *src, size_t n);
+
+#endif
+
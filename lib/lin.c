@@ -0,0 +1,1441 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+/*
+ * ISO PDF 2.0 Annex F Linearized files. The order is:
+ *
+ *   1  header
+ *   2  linearization parameter dictionary
+ *   3  first-page cross-reference table and trailer
+ *   4  catalog and other objects for opening the document
+ *   5  primary hint stream
+ *   6  the first page's objects, and shared objects it uses
+ *   7  the remaining pages' objects, a page at a time
+ *   8  shared objects for the remaining pages
+ *   9  other objects
+ *  10  main cross-reference table and trailer
+ *
+ * Parts 2 to 6 are numbered after the rest, so that the main table
+ * begins at object 0. Since the caller numbers objects as it goes,
+ * everything is renumbered: the first pass notes where each object
+ * number was printed to the spill, and the second copies objects from
+ * the spill with their numbers replaced.
+ *
+ * Every offset is known before the second pass writes anything, and so
+ * no overflow hint stream is needed. The hint stream is left unencoded,
+ * so that its length doesn't depend on the offsets it holds, and then the
+ * only circularity is parts 2 and 3, which hold offsets past themselves.
+ * Those are laid out repeatedly until their length settles, which it must,
+ * since their length only grows with the offsets they hold.
+ */
+
+/* for pread(2) */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/arena.h>
+#include <qdf/sink.h>
+#include <qdf/print.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+#include <qdf/doc.h>
+
+#include "filter.h"
+#include "token.h"
+#include "sink.h"
+#include "fmt.h"
+#include "doc.h"
+#include "lin.h"
+
+/* for C99 compound literals */
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
+/* Objects at most this long are read from the spill whole */
+#define LIN_SCRATCH (16 * 1024)
+
+/* Parts 2 and 3 settle in a few rounds; this is far more than enough */
+#define LIN_ROUNDS 16
+
+struct lin_ref {
+	uint64_t off; /* of the object number, in the spill */
+	unsigned id;
+};
+
+struct lin_obj {
+	uint64_t end;  /* just past "endobj", in the spill */
+	uint64_t size; /* in the output, renumbered, with its EOL */
+	uint64_t off;  /* in the output */
+	size_t ref;    /* its first entry in refs[] */
+	size_t nref;
+	enum qdf_lin_part part;
+	unsigned page;
+	unsigned num;   /* its object number in the output */
+	unsigned stamp; /* the last page to reach it, plus one */
+	unsigned sh;    /* its shared object identifier, for the hint tables */
+	bool placed;
+};
+
+/* Ranges of ord[] for each part */
+enum lin_section {
+	LIN_PART4,
+	LIN_PART6,
+	LIN_PART7,
+	LIN_PART8,
+	LIN_PART9,
+	LIN_FREE,
+	LIN_SECTIONS
+};
+
+struct qdf_lin {
+	struct qdf_sink *out; /* the caller's sink; doc->sink is the spill until the end */
+	struct qdf_sink spill;
+	struct sink_hook hook; /* the spill's opaque */
+	int fd;
+
+	unsigned cur; /* the object being printed to the spill */
+
+	struct lin_obj *obj;
+	size_t size;
+
+	struct lin_ref *refs;
+	size_t nrefs;
+	size_t refsize;
+
+	unsigned *pages; /* page objects, in order */
+	size_t npages;
+	size_t pagesize;
+
+	/* the second pass */
+	unsigned *ord;           /* ids in output order, by section */
+	size_t sec[LIN_SECTIONS + 1];
+	size_t *pstart;          /* where each page begins in ord[], for part 7 */
+	unsigned *shids;         /* the shared objects each page uses */
+	size_t *shstart;         /* where each page's list begins in shids[] */
+	size_t nshids;
+	size_t shsize;
+
+	unsigned n;       /* the main table's size; numbers below are parts 7 to 9 */
+	unsigned linnum;  /* the linearization dictionary */
+	unsigned hintnum; /* the primary hint stream */
+	unsigned total;
+
+	struct filter_buf head; /* parts 1 to 3 */
+	struct filter_buf hint; /* part 5 */
+	struct filter_buf tail; /* the main trailer */
+
+	uint64_t h;      /* length of parts 1 to 3 */
+	uint64_t fxref;  /* offset of the first-page table */
+	uint64_t hoff;   /* offset of the hint stream */
+	uint64_t hlen;
+	uint64_t e;      /* end of the first page */
+	uint64_t xref;   /* offset of the main table */
+	uint64_t t;      /* the EOL before the main table's first entry */
+	uint64_t l;      /* length of the file */
+};
+
+static bool
+grow(void *p, size_t *size, size_t need, size_t elem)
+{
+	void **pp = p;
+	size_t n;
+	void *tmp;
+
+	assert(p != NULL);
+	assert(size != NULL);
+
+	if (need <= *size) {
+		return true;
+	}
+
+	for (n = *size > 0 ? *size : 64; n < need; n *= 2)
+		;
+
+	tmp = realloc(*pp, n * elem);
+	if (tmp == NULL) {
+		return false;
+	}
+
+	/* zeroed, so objects never printed read as such */
+	memset((char *) tmp + *size * elem, 0, (n - *size) * elem);
+
+	*pp   = tmp;
+	*size = n;
+
+	return true;
+}
+
+static unsigned
+digits(uint64_t v)
+{
+	unsigned n;
+
+	for (n = 1; v >= 10; n++) {
+		v /= 10;
+	}
+
+	return n;
+}
+
+static unsigned
+nbits(uint64_t v)
+{
+	unsigned n;
+
+	for (n = 0; v > 0; n++) {
+		v >>= 1;
+	}
+
+	return n;
+}
+
+static bool
+note_ref(struct sink_hook *hook, uint64_t offset, unsigned id)
+{
+	struct qdf_lin *lin;
+
+	assert(hook != NULL);
+
+	lin = (struct qdf_lin *) ((char *) hook - offsetof(struct qdf_lin, hook));
+
+	if (!grow(&lin->refs, &lin->refsize, lin->nrefs + 1, sizeof *lin->refs)) {
+		return false;
+	}
+
+	lin->refs[lin->nrefs].off = offset;
+	lin->refs[lin->nrefs].id  = id;
+	lin->nrefs++;
+
+	return true;
+}
+
+bool
+lin_init(struct qdf_doc *doc, int spill)
+{
+	struct qdf_lin *lin;
+
+	assert(doc != NULL);
+	assert(doc->sink != NULL);
+	assert(spill != -1);
+
+	lin = calloc(1, sizeof *lin);
+	if (lin == NULL) {
+		return false;
+	}
+
+	lin->out = doc->sink;
+	lin->fd  = spill;
+
+	lin->hook.fd  = spill;
+	lin->hook.ref = note_ref;
+
+	if (!qdf_sink_init(&lin->spill, NULL, 0, sink_hook_write, &lin->hook)) {
+		free(lin);
+		return false;
+	}
+
+	/* for sink_copy_fd(), as though made by qdf_sink_init_fd() */
+	lin->spill.fd        = spill;
+	lin->spill.mode      = doc->sink->mode;
+	lin->spill.precision = doc->sink->precision;
+
+	doc->sink = &lin->spill;
+	doc->lin  = lin;
+
+	return true;
+}
+
+void
+lin_fini(struct qdf_doc *doc)
+{
+	struct qdf_lin *lin;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	(void) qdf_sink_fini(&lin->spill);
+
+	doc->sink = lin->out;
+	doc->lin  = NULL;
+
+	free(lin->obj);
+	free(lin->refs);
+	free(lin->pages);
+	free(lin->ord);
+	free(lin->pstart);
+	free(lin->shids);
+	free(lin->shstart);
+	free(lin->head.p);
+	free(lin->hint.p);
+	free(lin->tail.p);
+	free(lin);
+}
+
+bool
+lin_begin(struct qdf_doc *doc, unsigned id)
+{
+	struct qdf_lin *lin;
+	struct lin_obj *o;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	if (!grow(&lin->obj, &lin->size, (size_t) id + 1, sizeof *lin->obj)) {
+		return false;
+	}
+
+	if (doc->part == QDF_LIN_PAGE && lin->npages == 0) {
+		errno = EINVAL;
+		return false;
+	}
+
+	o = &lin->obj[id];
+
+	o->ref  = lin->nrefs;
+	o->part = doc->part;
+	o->page = lin->npages > 0 ? lin->npages - 1 : 0;
+
+	lin->cur = id;
+
+	return true;
+}
+
+void
+lin_end(struct qdf_doc *doc)
+{
+	struct qdf_lin *lin;
+	struct lin_obj *o;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+	o = &lin->obj[lin->cur];
+
+	o->end  = qdf_sink_offset(&lin->spill);
+	o->nref = lin->nrefs - o->ref;
+}
+
+bool
+lin_page(struct qdf_doc *doc, unsigned id)
+{
+	struct qdf_lin *lin;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	if (id == 0 || id >= doc->next) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (!grow(&lin->pages, &lin->pagesize, lin->npages + 1, sizeof *lin->pages)) {
+		return false;
+	}
+
+	lin->pages[lin->npages++] = id;
+
+	doc->part = QDF_LIN_PAGE;
+
+	/* a page object defined ahead of its call */
+	if (id < lin->size && doc->x[id].off != 0) {
+		lin->obj[id].part = QDF_LIN_PAGE;
+		lin->obj[id].page = lin->npages - 1;
+	}
+
+	return true;
+}
+
+void
+lin_share(struct qdf_doc *doc, unsigned id)
+{
+	struct qdf_lin *lin;
+	struct lin_obj *o;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	assert(id < lin->size);
+
+	o = &lin->obj[id];
+
+	if (o->part != QDF_LIN_PAGE || id == lin->pages[o->page]) {
+		return;
+	}
+
+	if (doc->part == QDF_LIN_PAGE && o->page == lin->npages - 1) {
+		return;
+	}
+
+	o->part = QDF_LIN_SHARED;
+}
+
+static bool
+defined_here(const struct qdf_doc *doc, unsigned id)
+{
+	assert(doc != NULL);
+
+	return doc->x[id].off != 0;
+}
+
+static void
+push(struct qdf_lin *lin, size_t *n, unsigned id)
+{
+	assert(lin != NULL);
+	assert(n != NULL);
+
+	lin->ord[(*n)++] = id;
+	lin->obj[id].placed = true;
+}
+
+/*
+ * The shared objects page k uses, through its own objects and through
+ * other shared objects, in the order they're reached. They're appended
+ * to ord[] for the first page, and to shids[] otherwise.
+ */
+static bool
+lin_reach(struct qdf_doc *doc, unsigned k, size_t own, size_t ownn)
+{
+	struct qdf_lin *lin;
+	size_t i, j, q, qn;
+	unsigned id, t;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	if (k > 0) {
+		lin->shstart[k] = lin->nshids;
+	}
+
+	/* the queue is the tail of ord[] or shids[] as it grows */
+	q  = k == 0 ? lin->sec[LIN_PART6 + 1] : lin->nshids;
+	qn = q;
+
+	for (i = own; ; i++) {
+		if (i < own + ownn) {
+			id = lin->ord[i];
+		} else if (q < qn) {
+			id = k == 0 ? lin->ord[q++] : lin->shids[q++];
+		} else {
+			break;
+		}
+
+		for (j = lin->obj[id].ref; j < lin->obj[id].ref + lin->obj[id].nref; j++) {
+			t = lin->refs[j].id;
+
+			if (t == 0 || t >= doc->next) {
+				errno = EINVAL;
+				return false;
+			}
+
+			if (t == id || !defined_here(doc, t)) {
+				continue;
+			}
+
+			if (lin->obj[t].part != QDF_LIN_SHARED || lin->obj[t].stamp == k + 1) {
+				continue;
+			}
+
+			lin->obj[t].stamp = k + 1;
+
+			if (k == 0) {
+				push(lin, &qn, t);
+				continue;
+			}
+
+			if (!grow(&lin->shids, &lin->shsize, lin->nshids + 1, sizeof *lin->shids)) {
+				return false;
+			}
+
+			lin->shids[lin->nshids++] = t;
+			qn++;
+		}
+	}
+
+	if (k == 0) {
+		lin->sec[LIN_PART6 + 1] = qn;
+	}
+
+	return true;
+}
+
+/* Sorts objects into parts, and numbers them for the output */
+static bool
+lin_order(struct qdf_doc *doc)
+{
+	struct qdf_lin *lin;
+	struct lin_obj *o;
+	size_t n, i, j, p;
+	unsigned id, num, k;
+	uint64_t size;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	/* ISO PDF 2.0 F.3.2 t F.1 /N "The number of pages in the document" */
+	if (lin->npages == 0) {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (!grow(&lin->obj, &lin->size, doc->next, sizeof *lin->obj)) {
+		return false;
+	}
+
+	for (k = 0; k < lin->npages; k++) {
+		id = lin->pages[k];
+
+		if (!defined_here(doc, id) || lin->obj[id].part != QDF_LIN_PAGE || lin->obj[id].page != k) {
+			errno = EINVAL;
+			return false;
+		}
+	}
+
+	lin->obj[doc->root].part = QDF_LIN_DOC;
+
+	lin->ord     = malloc(doc->next * sizeof *lin->ord);
+	lin->pstart  = malloc((lin->npages + 1) * sizeof *lin->pstart);
+	lin->shstart = malloc((lin->npages + 1) * sizeof *lin->shstart);
+	if (lin->ord == NULL || lin->pstart == NULL || lin->shstart == NULL) {
+		return false;
+	}
+
+	n = 0;
+
+	/* part 4, with the catalog first */
+	lin->sec[LIN_PART4] = n;
+	push(lin, &n, doc->root);
+
+	for (id = 1; id < doc->next; id++) {
+		if (defined_here(doc, id) && lin->obj[id].part == QDF_LIN_DOC && id != doc->root) {
+			push(lin, &n, id);
+		}
+	}
+
+	/*
+	 * Parts 6 and 7, each page's page object first. Each page's own
+	 * objects are gathered in one pass over all objects per page kind,
+	 * by counting them first.
+	 */
+	for (k = 0; k <= lin->npages; k++) {
+		lin->pstart[k] = 0;
+	}
+
+	for (id = 1; id < doc->next; id++) {
+		o = &lin->obj[id];
+
+		if (defined_here(doc, id) && o->part == QDF_LIN_PAGE && id != lin->pages[o->page]) {
+			lin->pstart[o->page + 1]++;
+		}
+	}
+
+	for (k = 0; k < lin->npages; k++) {
+		lin->pstart[k + 1] += lin->pstart[k] + 1;
+	}
+
+	/* the page objects */
+	for (k = 0; k < lin->npages; k++) {
+		p = lin->pstart[k];
+		lin->ord[n + p] = lin->pages[k];
+		lin->obj[lin->pages[k]].placed = true;
+		lin->pstart[k] = p + 1;
+	}
+
+	for (id = 1; id < doc->next; id++) {
+		o = &lin->obj[id];
+
+		if (defined_here(doc, id) && o->part == QDF_LIN_PAGE && id != lin->pages[o->page]) {
+			lin->ord[n + lin->pstart[o->page]++] = id;
+			o->placed = true;
+		}
+	}
+
+	/* pstart[k] is now the end of page k; make it the start again */
+	for (k = lin->npages; k > 0; k--) {
+		lin->pstart[k] = n + lin->pstart[k - 1];
+	}
+	lin->pstart[0] = n;
+
+	/*
+	 * The first page's shared objects go in part 6 after its own objects,
+	 * which means moving part 7 along to make room; so part 7 is moved
+	 * out of the way first.
+	 */
+	{
+		size_t p6n = lin->pstart[1] - lin->pstart[0];
+		size_t p7n = lin->pstart[lin->npages] - lin->pstart[1];
+		unsigned *p7;
+
+		p7 = malloc((p7n > 0 ? p7n : 1) * sizeof *p7);
+		if (p7 == NULL) {
+			return false;
+		}
+
+		memcpy(p7, lin->ord + lin->pstart[1], p7n * sizeof *p7);
+
+		lin->sec[LIN_PART6]     = n;
+		lin->sec[LIN_PART6 + 1] = n + p6n;
+
+		if (!lin_reach(doc, 0, n, p6n)) {
+			free(p7);
+			return false;
+		}
+
+		n = lin->sec[LIN_PART6 + 1];
+
+		lin->sec[LIN_PART7] = n;
+
+		for (k = lin->npages; k > 1; k--) {
+			lin->pstart[k] = lin->pstart[k] - lin->pstart[1] + n;
+		}
+		lin->pstart[1] = n;
+
+		memcpy(lin->ord + n, p7, p7n * sizeof *p7);
+		n += p7n;
+
+		free(p7);
+	}
+
+	/* the remaining pages' shared objects */
+	lin->nshids = 0;
+
+	for (k = 1; k < lin->npages; k++) {
+		if (!lin_reach(doc, k, lin->pstart[k], lin->pstart[k + 1] - lin->pstart[k])) {
+			return false;
+		}
+	}
+
+	lin->shstart[lin->npages] = lin->nshids;
+
+	/* part 8 */
+	lin->sec[LIN_PART8] = n;
+
+	for (id = 1; id < doc->next; id++) {
+		if (defined_here(doc, id) && lin->obj[id].part == QDF_LIN_SHARED && !lin->obj[id].placed) {
+			push(lin, &n, id);
+		}
+	}
+
+	/* part 9, including shared objects no page uses */
+	lin->sec[LIN_PART9] = n;
+
+	for (id = 1; id < doc->next; id++) {
+		if (defined_here(doc, id) && !lin->obj[id].placed) {
+			push(lin, &n, id);
+		}
+	}
+
+	/* ids allocated but never defined, which references may still name */
+	lin->sec[LIN_FREE] = n;
+
+	for (id = 1; id < doc->next; id++) {
+		if (!defined_here(doc, id)) {
+			push(lin, &n, id);
+		}
+	}
+
+	lin->sec[LIN_SECTIONS] = n;
+
+	assert(n == doc->next - 1);
+
+	/* the main table's objects are numbered from 1, then the first page's */
+	num = 1;
+
+	for (i = lin->sec[LIN_PART7]; i < lin->sec[LIN_SECTIONS]; i++) {
+		lin->obj[lin->ord[i]].num = num++;
+	}
+
+	lin->n      = num;
+	lin->linnum = num++;
+
+	for (i = lin->sec[LIN_PART4]; i < lin->sec[LIN_PART4 + 1]; i++) {
+		lin->obj[lin->ord[i]].num = num++;
+	}
+
+	lin->hintnum = num++;
+
+	for (i = lin->sec[LIN_PART6]; i < lin->sec[LIN_PART6 + 1]; i++) {
+		lin->obj[lin->ord[i]].num = num++;
+	}
+
+	lin->total = num;
+
+	/* shared object identifiers are indexes into the shared object hint table */
+	for (i = lin->sec[LIN_PART6]; i < lin->sec[LIN_PART6 + 1]; i++) {
+		lin->obj[lin->ord[i]].sh = i - lin->sec[LIN_PART6];
+	}
+
+	for (i = lin->sec[LIN_PART8]; i < lin->sec[LIN_PART8 + 1]; i++) {
+		lin->obj[lin->ord[i]].sh = (lin->sec[LIN_PART6 + 1] - lin->sec[LIN_PART6])
+			+ (i - lin->sec[LIN_PART8]);
+	}
+
+	/* lengths in the output, as renumbering changes how many digits there are */
+	for (i = lin->sec[LIN_PART4]; i < lin->sec[LIN_FREE]; i++) {
+		id = lin->ord[i];
+		o  = &lin->obj[id];
+
+		size = o->end - doc->x[id].off + 1;
+
+		for (j = o->ref; j < o->ref + o->nref; j++) {
+			if (lin->refs[j].id == 0 || lin->refs[j].id >= doc->next) {
+				errno = EINVAL;
+				return false;
+			}
+
+			size += digits(lin->obj[lin->refs[j].id].num);
+			size -= digits(lin->refs[j].id);
+		}
+
+		o->size = size;
+	}
+
+	return true;
+}
+
+/* Offsets in the output, given the length of parts 1 to 3 */
+static void
+lin_layout(struct qdf_doc *doc, uint64_t h)
+{
+	struct qdf_lin *lin;
+	uint64_t off;
+	size_t i;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	off = h;
+
+	for (i = lin->sec[LIN_PART4]; i < lin->sec[LIN_FREE]; i++) {
+		if (i == lin->sec[LIN_PART6]) {
+			lin->hoff = off;
+			off += lin->hlen;
+		}
+
+		lin->obj[lin->ord[i]].off = off;
+		off += lin->obj[lin->ord[i]].size;
+
+		if (i + 1 == lin->sec[LIN_PART6 + 1]) {
+			lin->e = off;
+		}
+	}
+
+	lin->h    = h;
+	lin->xref = off;
+	lin->t    = off + strlen("xref\n0 ") + digits(lin->n);
+}
+
+/* ISO PDF 2.0 F.4 "all offsets ... shall be computed as if the hint streams were not present" */
+static uint64_t
+lin_adjust(const struct qdf_lin *lin, uint64_t off)
+{
+	assert(lin != NULL);
+
+	return off > lin->hoff ? off - lin->hlen : off;
+}
+
+struct bits {
+	struct filter_buf *b;
+	unsigned acc;
+	unsigned n;
+	bool ok;
+};
+
+/* Big-endian bit fields, as F.4 "The most significant bit is first" */
+static void
+bits_put(struct bits *w, uint64_t v, unsigned n)
+{
+	unsigned char c;
+
+	assert(w != NULL);
+
+	while (n-- > 0) {
+		w->acc = w->acc << 1 | (unsigned) (v >> n & 1);
+
+		if (++w->n == 8) {
+			c = w->acc;
+			w->ok = w->ok && filter_collect(w->b, &c, 1);
+			w->acc = 0;
+			w->n   = 0;
+		}
+	}
+}
+
+/* F.4 Each item's entries begin at a byte boundary */
+static void
+bits_align(struct bits *w)
+{
+	assert(w != NULL);
+
+	if (w->n > 0) {
+		bits_put(w, 0, 8 - w->n);
+	}
+}
+
+static uint64_t
+page_len(const struct qdf_lin *lin, unsigned k)
+{
+	assert(lin != NULL);
+
+	if (k == 0) {
+		return lin->e - lin->obj[lin->ord[lin->sec[LIN_PART6]]].off;
+	}
+
+	return lin->obj[lin->ord[lin->pstart[k + 1] - 1]].off
+		+ lin->obj[lin->ord[lin->pstart[k + 1] - 1]].size
+		- lin->obj[lin->ord[lin->pstart[k]]].off;
+}
+
+static size_t
+page_nobj(const struct qdf_lin *lin, unsigned k)
+{
+	assert(lin != NULL);
+
+	if (k == 0) {
+		return lin->sec[LIN_PART6 + 1] - lin->sec[LIN_PART6];
+	}
+
+	return lin->pstart[k + 1] - lin->pstart[k];
+}
+
+/*
+ * ISO PDF 2.0 F.4.1 The page offset hint table, and F.4.2 the shared
+ * object hint table. The first page's shared objects are counted among
+ * its own, since they're in part 6 with it. Content streams aren't told
+ * apart from the rest of a page, and so each page's content is given as
+ * the whole page. Shared object groups are one object each.
+ *
+ * Returns the offset of the shared object hint table, for /S.
+ */
+static size_t
+lin_hints(struct qdf_doc *doc, struct filter_buf *b, bool *ok)
+{
+	const struct qdf_lin *lin;
+	uint64_t minobj, maxobj, minlen, maxlen, maxsh, maxid;
+	uint64_t mingrp, maxgrp;
+	struct bits w;
+	size_t s, i, j;
+	unsigned k;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+	assert(b != NULL);
+
+	lin = doc->lin;
+
+	w.b   = b;
+	w.acc = 0;
+	w.n   = 0;
+	w.ok  = true;
+
+	minobj = UINT64_MAX; maxobj = 0;
+	minlen = UINT64_MAX; maxlen = 0;
+	maxsh  = 0;          maxid  = 0;
+
+	for (k = 0; k < lin->npages; k++) {
+		if (page_nobj(lin, k) < minobj) minobj = page_nobj(lin, k);
+		if (page_nobj(lin, k) > maxobj) maxobj = page_nobj(lin, k);
+		if (page_len (lin, k) < minlen) minlen = page_len (lin, k);
+		if (page_len (lin, k) > maxlen) maxlen = page_len (lin, k);
+
+		if (k > 0) {
+			if (lin->shstart[k + 1] - lin->shstart[k] > maxsh) {
+				maxsh = lin->shstart[k + 1] - lin->shstart[k];
+			}
+
+			for (j = lin->shstart[k]; j < lin->shstart[k + 1]; j++) {
+				if (lin->obj[lin->shids[j]].sh > maxid) {
+					maxid = lin->obj[lin->shids[j]].sh;
+				}
+			}
+		}
+	}
+
+	/* F.4.1 t F.3 */
+	bits_put(&w, minobj, 32);
+	bits_put(&w, lin_adjust(lin, lin->obj[lin->pages[0]].off), 32);
+	bits_put(&w, nbits(maxobj - minobj), 16);
+	bits_put(&w, minlen, 32);
+	bits_put(&w, nbits(maxlen - minlen), 16);
+	bits_put(&w, 0, 32);
+	bits_put(&w, 0, 16);
+	bits_put(&w, minlen, 32);
+	bits_put(&w, nbits(maxlen - minlen), 16);
+	bits_put(&w, nbits(maxsh), 16);
+	bits_put(&w, nbits(maxid), 16);
+	bits_put(&w, 0, 16);
+	bits_put(&w, 1, 16);
+
+	/* F.4.1 t F.4, each item for every page in turn */
+	for (k = 0; k < lin->npages; k++) {
+		bits_put(&w, page_nobj(lin, k) - minobj, nbits(maxobj - minobj));
+	}
+	bits_align(&w);
+
+	for (k = 0; k < lin->npages; k++) {
+		bits_put(&w, page_len(lin, k) - minlen, nbits(maxlen - minlen));
+	}
+	bits_align(&w);
+
+	for (k = 0; k < lin->npages; k++) {
+		bits_put(&w, k == 0 ? 0 : lin->shstart[k + 1] - lin->shstart[k], nbits(maxsh));
+	}
+	bits_align(&w);
+
+	for (k = 1; k < lin->npages; k++) {
+		for (j = lin->shstart[k]; j < lin->shstart[k + 1]; j++) {
+			bits_put(&w, lin->obj[lin->shids[j]].sh, nbits(maxid));
+		}
+	}
+	bits_align(&w);
+
+	/* numerators and content stream offsets take no bits */
+
+	for (k = 0; k < lin->npages; k++) {
+		bits_put(&w, page_len(lin, k) - minlen, nbits(maxlen - minlen));
+	}
+	bits_align(&w);
+
+	s = b->n;
+
+	/* F.4.2 t F.5, for part 6 and then part 8 */
+	mingrp = UINT64_MAX;
+	maxgrp = 0;
+
+	for (i = lin->sec[LIN_PART6]; i < lin->sec[LIN_PART8 + 1]; i++) {
+		if (i == lin->sec[LIN_PART6 + 1]) {
+			i = lin->sec[LIN_PART8];
+			if (i == lin->sec[LIN_PART8 + 1]) {
+				break;
+			}
+		}
+
+		if (lin->obj[lin->ord[i]].size < mingrp) mingrp = lin->obj[lin->ord[i]].size;
+		if (lin->obj[lin->ord[i]].size > maxgrp) maxgrp = lin->obj[lin->ord[i]].size;
+	}
+
+	if (lin->sec[LIN_PART8] < lin->sec[LIN_PART8 + 1]) {
+		bits_put(&w, lin->obj[lin->ord[lin->sec[LIN_PART8]]].num, 32);
+		bits_put(&w, lin_adjust(lin, lin->obj[lin->ord[lin->sec[LIN_PART8]]].off), 32);
+	} else {
+		bits_put(&w, 0, 32);
+		bits_put(&w, 0, 32);
+	}
+
+	bits_put(&w, lin->sec[LIN_PART6 + 1] - lin->sec[LIN_PART6], 32);
+	bits_put(&w, lin->sec[LIN_PART6 + 1] - lin->sec[LIN_PART6]
+		+ lin->sec[LIN_PART8 + 1] - lin->sec[LIN_PART8], 32);
+	bits_put(&w, 0, 16);
+	bits_put(&w, mingrp, 32);
+	bits_put(&w, nbits(maxgrp - mingrp), 16);
+
+	/* F.4.2 t F.6 */
+	for (j = 0; j < 2; j++) {
+		for (i = lin->sec[j == 0 ? LIN_PART6 : LIN_PART8]; i < lin->sec[(j == 0 ? LIN_PART6 : LIN_PART8) + 1]; i++) {
+			bits_put(&w, lin->obj[lin->ord[i]].size - mingrp, nbits(maxgrp - mingrp));
+		}
+	}
+	bits_align(&w);
+
+	/* no MD5 signatures */
+	for (i = 0; i < lin->sec[LIN_PART6 + 1] - lin->sec[LIN_PART6] + lin->sec[LIN_PART8 + 1] - lin->sec[LIN_PART8]; i++) {
+		bits_put(&w, 0, 1);
+	}
+	bits_align(&w);
+
+	*ok = w.ok;
+
+	return s;
+}
+
+/* Renders the hint stream object, for the current layout */
+static bool
+lin_render_hint(struct qdf_doc *doc)
+{
+	const unsigned gen = 0;
+	struct filter_buf data = { NULL, 0, 0 };
+	struct qdf_lin *lin;
+	struct qdf_sink m;
+	size_t s;
+	bool ok;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	s = lin_hints(doc, &data, &ok);
+	if (!ok) {
+		free(data.p);
+		return false;
+	}
+
+	lin->hint.n = 0;
+
+	if (!qdf_sink_init(&m, NULL, QDF_SINK_MIN, doc_mem_write, &lin->hint)) {
+		free(data.p);
+		return false;
+	}
+
+	m.mode      = lin->out->mode;
+	m.precision = lin->out->precision;
+
+	const struct token extra[] = {
+		{ TOK_NAME, .u.name = "S" }, { TOK_SIZE, .u.z = s }
+	};
+
+	qdf_print_token(&m, & (struct token) { TOK_DEF_OPEN, .u.ref = { lin->hintnum, gen } });
+
+	ok = qdf_print_stream_with(&m, extra, sizeof extra / sizeof *extra,
+		& (struct qdf_stream) { .data = { data.p, data.n } });
+
+	qdf_print_token(&m, & (struct token) { TOK_DEF_CLOSE });
+	qdf_print_token(&m, & (struct token) { TOK_BR });
+
+	free(data.p);
+
+	return qdf_sink_fini(&m) && ok;
+}
+
+static void
+print_xref_head(struct qdf_sink *sink, unsigned first, unsigned n)
+{
+	assert(sink != NULL);
+	assert(sink->bol);
+
+	sink_puts(sink, "xref\n");
+	qdf_print_token(sink, & (struct token) { TOK_SIZE, .u.z = first });
+	qdf_print_token(sink, & (struct token) { TOK_SIZE, .u.z = n });
+	qdf_print_token(sink, & (struct token) { TOK_BR });
+}
+
+static void
+print_trailer_open(struct qdf_sink *sink)
+{
+	assert(sink != NULL);
+
+	sink_puts(sink, "trailer\n");
+	sink->bol = true;
+
+	qdf_print_token(sink, & (struct token) { TOK_DICT_OPEN });
+}
+
+/* Parts 1 to 3, for the current layout; sets h and fxref */
+static bool
+lin_render_head(struct qdf_doc *doc)
+{
+	const unsigned gen = 0;
+	struct qdf_lin *lin;
+	unsigned char id[16];
+	struct qdf_sink m;
+	uint64_t linoff;
+	size_t i;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	lin->head.n = 0;
+
+	if (!qdf_sink_init(&m, NULL, 0, doc_mem_write, &lin->head)) {
+		return false;
+	}
+
+	m.mode      = lin->out->mode;
+	m.precision = lin->out->precision;
+
+	qdf_print_token(&m, & (struct token) { TOK_VER, .u.ver = doc->ver });
+
+	linoff = qdf_sink_offset(&m);
+
+	/* ISO PDF 2.0 F.3.3 t F.1 */
+	qdf_print_token(&m, & (struct token) { TOK_DEF_OPEN, .u.ref = { lin->linnum, gen } });
+	qdf_print_token(&m, & (struct token) { TOK_DICT_OPEN });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Linearized" });
+	qdf_print_token(&m, & (struct token) { TOK_INT,  .u.i    = 1 });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "L" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->l });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "H" });
+	qdf_print_token(&m, & (struct token) { TOK_ARRAY_OPEN });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->hoff });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->hlen });
+	qdf_print_token(&m, & (struct token) { TOK_ARRAY_CLOSE });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "O" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->obj[lin->pages[0]].num });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "E" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->e });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "N" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->npages });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "T" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->t });
+	qdf_print_token(&m, & (struct token) { TOK_DICT_CLOSE });
+	qdf_print_token(&m, & (struct token) { TOK_DEF_CLOSE });
+	qdf_print_token(&m, & (struct token) { TOK_BR });
+
+	/* ISO PDF 2.0 F.3.4 the first-page table, for parts 2 to 6 */
+	lin->fxref = qdf_sink_offset(&m);
+
+	print_xref_head(&m, lin->linnum, lin->total - lin->linnum);
+
+	doc_xref_entry(&m, linoff, 0, 'n');
+
+	for (i = lin->sec[LIN_PART4]; i < lin->sec[LIN_PART4 + 1]; i++) {
+		doc_xref_entry(&m, lin->obj[lin->ord[i]].off, 0, 'n');
+	}
+
+	doc_xref_entry(&m, lin->hoff, 0, 'n');
+
+	for (i = lin->sec[LIN_PART6]; i < lin->sec[LIN_PART6 + 1]; i++) {
+		doc_xref_entry(&m, lin->obj[lin->ord[i]].off, 0, 'n');
+	}
+
+	doc_hash(doc, lin->xref, id);
+
+	print_trailer_open(&m);
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Size" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->total });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Root" });
+	qdf_print_token(&m, & (struct token) { TOK_REF,  .u.ref  = { lin->obj[doc->root].num, gen } });
+	if (doc->info != 0) {
+		qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Info" });
+		qdf_print_token(&m, & (struct token) { TOK_REF,  .u.ref  = { lin->obj[doc->info].num, gen } });
+	}
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "ID" });
+	qdf_print_token(&m, & (struct token) { TOK_ARRAY_OPEN });
+	if (doc->id.n > 0) {
+		qdf_print_token(&m, & (struct token) { TOK_BIN, .u.data = doc->id });
+	} else {
+		qdf_print_token(&m, & (struct token) { TOK_BIN, .u.data = { id, sizeof id } });
+	}
+	qdf_print_token(&m, & (struct token) { TOK_BIN, .u.data = { id, sizeof id } });
+	qdf_print_token(&m, & (struct token) { TOK_ARRAY_CLOSE });
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Prev" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->xref });
+	qdf_print_token(&m, & (struct token) { TOK_DICT_CLOSE });
+
+	/*
+	 * F.3.4 "the startxref value ... in the first-page trailer ...
+	 * shall be ignored"; the end of the file gives the first-page table.
+	 */
+	doc_startxref(&m, 0);
+
+	lin->h = qdf_sink_offset(&m);
+
+	return qdf_sink_fini(&m);
+}
+
+/* The main trailer, which follows the main table; sets l */
+static bool
+lin_render_tail(struct qdf_doc *doc)
+{
+	struct qdf_lin *lin;
+	struct qdf_sink m;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	lin->tail.n = 0;
+
+	if (!qdf_sink_init(&m, NULL, QDF_SINK_MIN, doc_mem_write, &lin->tail)) {
+		return false;
+	}
+
+	m.mode      = lin->out->mode;
+	m.precision = lin->out->precision;
+
+	print_trailer_open(&m);
+	qdf_print_token(&m, & (struct token) { TOK_NAME, .u.name = "Size" });
+	qdf_print_token(&m, & (struct token) { TOK_SIZE, .u.z    = lin->n });
+	qdf_print_token(&m, & (struct token) { TOK_DICT_CLOSE });
+
+	doc_startxref(&m, lin->fxref);
+
+	lin->l = lin->xref + strlen("xref\n0 ") + digits(lin->n) + 1
+		+ (uint64_t) lin->n * 20 + qdf_sink_offset(&m);
+
+	return qdf_sink_fini(&m);
+}
+
+static bool
+spill_read(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = pread(fd, buf, len, offset);
+		if (r == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if (r == -1) {
+			return false;
+		}
+
+		if (r == 0) {
+			errno = EIO;
+			return false;
+		}
+
+		buf     = (char *) buf + r;
+		len    -= r;
+		offset += r;
+	}
+
+	return true;
+}
+
+static void
+put_num(struct qdf_sink *sink, unsigned num)
+{
+	assert(sink != NULL);
+
+	sink_commit(sink, fmt_uint((char *) sink_reserve(sink, FMT_INT_MAX), num));
+}
+
+/* Copies an object from the spill, renumbering as it goes */
+static bool
+lin_copy(struct qdf_doc *doc, unsigned id, unsigned char *scratch)
+{
+	struct qdf_lin *lin;
+	struct lin_obj *o;
+	uint64_t start, pos;
+	size_t j;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+	assert(scratch != NULL);
+
+	lin = doc->lin;
+	o = &lin->obj[id];
+
+	start = doc->x[id].off;
+	pos   = start;
+
+	assert(qdf_sink_offset(lin->out) == o->off);
+
+	if (o->end - start <= LIN_SCRATCH) {
+		if (!spill_read(lin->fd, scratch, o->end - start, start)) {
+			return false;
+		}
+
+		for (j = o->ref; j < o->ref + o->nref; j++) {
+			sink_write(lin->out, scratch + (pos - start), lin->refs[j].off - pos);
+			put_num(lin->out, lin->obj[lin->refs[j].id].num);
+			pos = lin->refs[j].off + digits(lin->refs[j].id);
+		}
+
+		sink_write(lin->out, scratch + (pos - start), o->end - pos);
+	} else {
+		for (j = o->ref; j < o->ref + o->nref; j++) {
+			if (!sink_copy_fd(lin->out, lin->fd, pos, lin->refs[j].off - pos)) {
+				return false;
+			}
+
+			put_num(lin->out, lin->obj[lin->refs[j].id].num);
+			pos = lin->refs[j].off + digits(lin->refs[j].id);
+		}
+
+		if (!sink_copy_fd(lin->out, lin->fd, pos, o->end - pos)) {
+			return false;
+		}
+	}
+
+	sink_putc(lin->out, '\n');
+
+	assert(lin->out->err != 0 || qdf_sink_offset(lin->out) == o->off + o->size);
+
+	return true;
+}
+
+static bool
+lin_copy_range(struct qdf_doc *doc, enum lin_section a, enum lin_section z,
+	unsigned char *scratch)
+{
+	struct qdf_lin *lin;
+	size_t i;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+
+	for (i = lin->sec[a]; i < lin->sec[z]; i++) {
+		if (!lin_copy(doc, lin->ord[i], scratch)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+lin_write(struct qdf_doc *doc)
+{
+	struct qdf_arena_mark m;
+	unsigned char *scratch;
+	struct qdf_lin *lin;
+	struct qdf_sink *out;
+	uint64_t h, fxref;
+	unsigned round;
+	size_t i, hlen;
+	unsigned num;
+
+	assert(doc != NULL);
+	assert(doc->lin != NULL);
+
+	lin = doc->lin;
+	out = lin->out;
+
+	if (!qdf_sink_flush(&lin->spill)) {
+		return false;
+	}
+
+	if (!lin_order(doc)) {
+		return false;
+	}
+
+	/* the hint stream's length doesn't depend on the layout */
+	lin->hlen = 0;
+	lin_layout(doc, 0);
+
+	if (!lin_render_hint(doc)) {
+		return false;
+	}
+
+	lin->hlen = lin->hint.n;
+
+	h     = 0;
+	fxref = 0;
+
+	for (round = 0; ; round++) {
+		if (round == LIN_ROUNDS) {
+			assert(!"unreached");
+			errno = EDOM;
+			return false;
+		}
+
+		lin_layout(doc, h);
+		lin->fxref = fxref;
+
+		if (!lin_render_tail(doc) || !lin_render_head(doc)) {
+			return false;
+		}
+
+		if (lin->h == h && lin->fxref == fxref) {
+			break;
+		}
+
+		h     = lin->h;
+		fxref = lin->fxref;
+	}
+
+	/* F.4 offsets and lengths in the hint tables are 32 bits */
+	if (lin->l > XREF_OFFSET_MAX || lin->l > UINT32_MAX) {
+		errno = EOVERFLOW;
+		return false;
+	}
+
+	hlen = lin->hint.n;
+
+	if (!lin_render_hint(doc)) {
+		return false;
+	}
+
+	assert(lin->hint.n == hlen);
+	(void) hlen;
+
+	m = qdf_arena_mark(&out->arena);
+
+	scratch = qdf_arena_alloc(&out->arena, LIN_SCRATCH);
+	if (scratch == NULL) {
+		return false;
+	}
+
+	sink_write(out, lin->head.p, lin->head.n);
+
+	if (!lin_copy_range(doc, LIN_PART4, LIN_PART4 + 1, scratch)) {
+		goto error;
+	}
+
+	sink_write(out, lin->hint.p, lin->hint.n);
+
+	if (!lin_copy_range(doc, LIN_PART6, LIN_FREE, scratch)) {
+		goto error;
+	}
+
+	qdf_arena_release(&out->arena, m);
+
+	/* ISO PDF 2.0 F.3.8 the main table, for objects 0 to n - 1 */
+	assert(qdf_sink_offset(out) == lin->xref);
+
+	out->bol = true;
+	print_xref_head(out, 0, lin->n);
+
+	num = lin->sec[LIN_FREE] < lin->sec[LIN_SECTIONS]
+		? lin->obj[lin->ord[lin->sec[LIN_FREE]]].num : 0;
+
+	doc_xref_entry(out, num, 65535, 'f');
+
+	for (i = lin->sec[LIN_PART7]; i < lin->sec[LIN_SECTIONS]; i++) {
+		if (i < lin->sec[LIN_FREE]) {
+			doc_xref_entry(out, lin->obj[lin->ord[i]].off, 0, 'n');
+			continue;
+		}
+
+		num = i + 1 < lin->sec[LIN_SECTIONS] ? lin->obj[lin->ord[i + 1]].num : 0;
+
+		doc_xref_entry(out, num, 0, 'f');
+	}
+
+	sink_write(out, lin->tail.p, lin->tail.n);
+	out->bol     = true;
+	out->regular = false;
+
+	assert(out->err != 0 || qdf_sink_offset(out) == lin->l);
+
+	return qdf_sink_flush(out);
+
+error:
+
+	qdf_arena_release(&out->arena, m);
+
+	return false;
+}
+
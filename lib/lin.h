@@ -0,0 +1,37 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_LIN_INTERNAL_H
+#define LIBQDF_LIN_INTERNAL_H
+
+/* Points doc->sink at the spill, keeping the caller's sink for the output */
+bool
+lin_init(struct qdf_doc *doc, int spill);
+
+void
+lin_fini(struct qdf_doc *doc);
+
+/* An object is about to be printed to the spill, at its recorded offset */
+bool
+lin_begin(struct qdf_doc *doc, unsigned id);
+
+/* ... and has been */
+void
+lin_end(struct qdf_doc *doc);
+
+bool
+lin_page(struct qdf_doc *doc, unsigned id);
+
+/* id is defined, and is wanted again by whatever's being defined now */
+void
+lin_share(struct qdf_doc *doc, unsigned id);
+
+/* The second pass, writing the whole file from the spill */
+bool
+lin_write(struct qdf_doc *doc);
+
+#endif
+
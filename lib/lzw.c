@@ -0,0 +1,533 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+
+#include "filter.h"
+#include "lzw.h"
+
+/*
+ * ISO PDF 2.0 7.4.4.2 LZW compression. Codes are 9 to 12 bits wide,
+ * 256 clears the table, and 257 marks EOD.
+ */
+enum {
+	LZW_CLEAR = 256,
+	LZW_EOD   = 257,
+	LZW_FIRST = 258,
+	LZW_LIMIT = 4094 /* clear the table on reaching this */
+};
+
+/*
+ * The dictionary maps (prefix code, next byte) to a code, by open
+ * addressing. Slots are tagged with a generation, so clearing the
+ * table is a counter increment rather than a memset.
+ */
+#define LZW_HASH_BITS 13
+#define LZW_HASH_SIZE (1U << LZW_HASH_BITS)
+#define LZW_GEN_MAX   ((1U << 12) - 1)
+
+struct lzw_slot {
+	uint32_t tag; /* generation << 20 | prefix << 8 | byte */
+	uint16_t code;
+};
+
+struct lzw {
+	int early_change;
+	uint32_t gen;
+	unsigned next;  /* next code to assign */
+	int prefix;     /* code for the string matched so far, or -1 */
+
+	uint64_t acc;
+	unsigned bits;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+
+	struct lzw_slot table[LZW_HASH_SIZE];
+};
+
+/*
+ * The decoder adds an entry on every code but the first after a clear,
+ * and so lags one entry behind the encoder. It reads codes at the width
+ * for its own next code, which widens "one code early" under EarlyChange.
+ */
+static unsigned
+lzw_width(const struct lzw *z)
+{
+	unsigned dec;
+
+	dec = z->next > LZW_FIRST ? z->next - 1 : z->next;
+	dec += z->early_change;
+
+	if (dec < 512)  return 9;
+	if (dec < 1024) return 10;
+	if (dec < 2048) return 11;
+
+	return 12;
+}
+
+static bool
+lzw_flush(struct filter_stage *st, struct lzw *z)
+{
+	assert(st != NULL);
+	assert(z != NULL);
+
+	if (z->n == 0) {
+		return true;
+	}
+
+	if (!st->emit(st->opaque, z->out, z->n)) {
+		return false;
+	}
+
+	z->n = 0;
+
+	return true;
+}
+
+static bool
+lzw_put(struct filter_stage *st, struct lzw *z, unsigned code)
+{
+	unsigned w;
+
+	assert(z != NULL);
+	assert(code < 4096);
+
+	w = lzw_width(z);
+
+	z->acc   = z->acc << w | code;
+	z->bits += w;
+
+	/* four bytes at a time; at most 31 + 12 bits are ever held */
+	if (z->bits >= 32) {
+		if (sizeof z->out - z->n < 4 && !lzw_flush(st, z)) {
+			return false;
+		}
+
+		z->bits -= 32;
+		z->out[z->n++] = z->acc >> (z->bits + 24);
+		z->out[z->n++] = z->acc >> (z->bits + 16);
+		z->out[z->n++] = z->acc >> (z->bits + 8);
+		z->out[z->n++] = z->acc >> (z->bits);
+	}
+
+	return true;
+}
+
+static void
+lzw_reset(struct lzw *z)
+{
+	assert(z != NULL);
+
+	z->next = LZW_FIRST;
+
+	if (z->gen == LZW_GEN_MAX) {
+		memset(z->table, 0, sizeof z->table);
+		z->gen = 0;
+	}
+
+	z->gen++;
+}
+
+static struct lzw_slot *
+lzw_find(struct lzw *z, unsigned prefix, unsigned char c)
+{
+	uint32_t key, tag, i;
+
+	assert(z != NULL);
+
+	key = prefix << 8 | c;
+	tag = z->gen << 20 | key;
+
+	i = (key * 2654435761U) >> (32 - LZW_HASH_BITS);
+
+	while (z->table[i].tag != tag) {
+		if (z->table[i].tag >> 20 != z->gen) {
+			break; /* empty in this generation */
+		}
+
+		i = (i + 1) & (LZW_HASH_SIZE - 1);
+	}
+
+	return &z->table[i];
+}
+
+static bool
+lzw_init(struct filter_stage *st)
+{
+	struct lzw *z;
+	qdf_int early_change;
+
+	assert(st != NULL);
+
+	early_change = st->f->u.lzw_flate.early_change;
+	if (early_change != 0 && early_change != 1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	/* calloc, so that every slot starts in generation 0, which is never used */
+	z = calloc(1, sizeof *z);
+	if (z == NULL) {
+		return false;
+	}
+
+	z->early_change = early_change;
+	z->prefix       = -1;
+
+	lzw_reset(z);
+
+	st->state = z;
+
+	/* ISO PDF 2.0 7.4.4.2 "The first output code that is 9 bits"
+	 * should be a clear-table code. */
+	return lzw_put(st, z, LZW_CLEAR);
+}
+
+static bool
+lzw_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct lzw *z;
+	size_t i;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	z = st->state;
+
+	i = 0;
+
+	if (z->prefix == -1 && n > 0) {
+		z->prefix = s[i++];
+	}
+
+	for ( ; i < n; i++) {
+		struct lzw_slot *e;
+
+		e = lzw_find(z, z->prefix, s[i]);
+		if (e->tag >> 20 == z->gen) {
+			z->prefix = e->code;
+			continue;
+		}
+
+		if (!lzw_put(st, z, z->prefix)) {
+			return false;
+		}
+
+		e->tag  = z->gen << 20 | (uint32_t) z->prefix << 8 | s[i];
+		e->code = z->next++;
+
+		if (z->next == LZW_LIMIT) {
+			if (!lzw_put(st, z, LZW_CLEAR)) {
+				return false;
+			}
+
+			lzw_reset(z);
+		}
+
+		z->prefix = s[i];
+	}
+
+	return true;
+}
+
+static bool
+lzw_finish(struct filter_stage *st)
+{
+	struct lzw *z;
+
+	assert(st != NULL);
+
+	z = st->state;
+
+	if (z->prefix != -1) {
+		if (!lzw_put(st, z, z->prefix)) {
+			return false;
+		}
+
+		/* the decoder adds an entry for this code, though we don't */
+		z->next++;
+		z->prefix = -1;
+	}
+
+	if (!lzw_put(st, z, LZW_EOD)) {
+		return false;
+	}
+
+	if (sizeof z->out - z->n < 6 && !lzw_flush(st, z)) {
+		return false;
+	}
+
+	while (z->bits >= 8) {
+		z->bits -= 8;
+		z->out[z->n++] = z->acc >> z->bits;
+	}
+
+	/* pad the final byte with zero bits */
+	if (z->bits > 0) {
+		z->out[z->n++] = z->acc << (8 - z->bits);
+		z->bits = 0;
+	}
+
+	return lzw_flush(st, z);
+}
+
+static void
+lzw_fini(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	free(st->state);
+}
+
+/*
+ * Decoding keeps each string as its prefix code and final byte, and
+ * writes it out backwards from its end. The output chunk is flushed
+ * ahead of a string that might not fit, so strings are never split.
+ */
+struct lzw_dec {
+	int early_change;
+	unsigned next;  /* next code to assign */
+	unsigned width;
+	int prev;       /* the previous code, or -1 after a clear */
+	bool eod;
+
+	uint32_t acc;
+	unsigned bits;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+
+	uint16_t prefix[4096];
+	uint16_t len[4096];
+	unsigned char suffix[4096];
+	unsigned char first[4096];
+};
+
+static void
+lzw_dec_reset(struct lzw_dec *z)
+{
+	assert(z != NULL);
+
+	z->next  = LZW_FIRST;
+	z->width = 9;
+	z->prev  = -1;
+}
+
+static bool
+lzw_dec_init(struct filter_stage *st)
+{
+	struct lzw_dec *z;
+	qdf_int early_change;
+	unsigned c;
+
+	assert(st != NULL);
+
+	early_change = st->f->u.lzw_flate.early_change;
+	if (early_change != 0 && early_change != 1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	z = malloc(sizeof *z);
+	if (z == NULL) {
+		return false;
+	}
+
+	for (c = 0; c < 256; c++) {
+		z->len[c]    = 1;
+		z->suffix[c] = c;
+		z->first[c]  = c;
+	}
+
+	z->early_change = early_change;
+	z->eod  = false;
+	z->acc  = 0;
+	z->bits = 0;
+	z->n    = 0;
+
+	lzw_dec_reset(z);
+
+	st->state = z;
+
+	return true;
+}
+
+static bool
+lzw_dec_flush(struct filter_stage *st, struct lzw_dec *z)
+{
+	assert(st != NULL);
+	assert(z != NULL);
+
+	if (z->n == 0) {
+		return true;
+	}
+
+	if (!st->emit(st->opaque, z->out, z->n)) {
+		return false;
+	}
+
+	z->n = 0;
+
+	return true;
+}
+
+/* Writes the string for code, followed by the byte c if c >= 0 */
+static bool
+lzw_dec_put(struct filter_stage *st, struct lzw_dec *z, unsigned code, int c)
+{
+	unsigned char *p, *q;
+	size_t len;
+
+	assert(z != NULL);
+
+	len = z->len[code];
+
+	if (sizeof z->out - z->n < len + 1 && !lzw_dec_flush(st, z)) {
+		return false;
+	}
+
+	p = z->out + z->n;
+	q = p + len;
+
+	if (c >= 0) {
+		*q = c;
+		z->n++;
+	}
+
+	do {
+		*--q = z->suffix[code];
+		code = z->prefix[code];
+	} while (q > p);
+
+	z->n += len;
+
+	return true;
+}
+
+static bool
+lzw_dec_code(struct filter_stage *st, struct lzw_dec *z, unsigned code)
+{
+	unsigned fb;
+
+	assert(z != NULL);
+
+	switch (code) {
+	case LZW_CLEAR:
+		lzw_dec_reset(z);
+		return true;
+
+	case LZW_EOD:
+		z->eod = true;
+		return true;
+	}
+
+	if (z->prev == -1) {
+		if (code > 0xff) {
+			errno = EINVAL;
+			return false;
+		}
+
+		z->prev = code;
+
+		return lzw_dec_put(st, z, code, -1);
+	}
+
+	if (code < z->next) {
+		fb = z->first[code];
+
+		if (!lzw_dec_put(st, z, code, -1)) {
+			return false;
+		}
+	} else if (code == z->next && z->next < 4096) {
+		/* the string being defined: prev's, and its own first byte */
+		fb = z->first[z->prev];
+
+		if (!lzw_dec_put(st, z, z->prev, fb)) {
+			return false;
+		}
+	} else {
+		errno = EINVAL;
+		return false;
+	}
+
+	if (z->next < 4096) {
+		z->prefix[z->next] = z->prev;
+		z->suffix[z->next] = fb;
+		z->len[z->next]    = z->len[z->prev] + 1;
+		z->first[z->next]  = z->first[z->prev];
+		z->next++;
+
+		if (z->next + z->early_change >= 1U << z->width && z->width < 12) {
+			z->width++;
+		}
+	}
+
+	z->prev = code;
+
+	return true;
+}
+
+static bool
+lzw_dec_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct lzw_dec *z;
+	unsigned code;
+	size_t i;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	z = st->state;
+
+	for (i = 0; i < n && !z->eod; i++) {
+		z->acc   = z->acc << 8 | s[i];
+		z->bits += 8;
+
+		if (z->bits < z->width) {
+			continue;
+		}
+
+		z->bits -= z->width;
+		code = (z->acc >> z->bits) & ((1U << z->width) - 1);
+
+		if (!lzw_dec_code(st, z, code)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* A missing EOD is tolerated; the padding bits are ignored */
+static bool
+lzw_dec_finish(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return lzw_dec_flush(st, st->state);
+}
+
+const struct filter_ops lzw_enc = {
+	lzw_init, lzw_update, lzw_finish, lzw_fini
+};
+
+const struct filter_ops lzw_dec = {
+	lzw_dec_init, lzw_dec_update, lzw_dec_finish, lzw_fini
+};
+
@@ -0,0 +1,13 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_NAME_INTERNAL_H
+#define LIBQDF_NAME_INTERNAL_H
+
+/* Non-zero for bytes which must be written as #xx in a name */
+extern const unsigned char name_escape_class[256];
+
+#endif
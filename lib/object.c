@@ -4,6 +4,8 @@
  * See LICENCE for the full copyright terms.
  */
 
+#include <sys/types.h>
+
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -16,12 +18,17 @@
 
 #include <qdf/version.h>
 #include <qdf/types.h>
+#include <qdf/arena.h>
+#include <qdf/sink.h>
 #include <qdf/print.h>
 #include <qdf/params.h>
 #include <qdf/filter.h>
+#include <qdf/source.h>
 
 #include "filter.h"
+#include "source.h"
 #include "token.h"
+#include "sink.h"
 
 /* for C99 compound literals */
 #if defined(__GNUC__) || defined(__clang__)
@@ -29,13 +36,13 @@
 #endif
 
 void
-qdf_vprintf_comment(FILE *f, const char *fmt, va_list ap)
+qdf_vprintf_comment(struct qdf_sink *sink, const char *fmt, va_list ap)
 {
 	char buf[256];
 	bool overflow;
 	size_t r, n;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(fmt != NULL);
 
 	overflow = false;
@@ -57,41 +64,43 @@ qdf_vprintf_comment(FILE *f, const char *fmt, va_list ap)
 		abort();
 	}
 
-	qdf_print_token(f, & (struct token) { TOK_COMMENT, .u.comment = buf } );
+	qdf_print_token(sink, & (struct token) { TOK_COMMENT, .u.comment = buf } );
 }
 
 void
-qdf_printf_comment(FILE *f, const char *fmt, ...)
+qdf_printf_comment(struct qdf_sink *sink, const char *fmt, ...)
 {
 	va_list ap;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(fmt != NULL);
 
 	va_start(ap, fmt);
-	qdf_vprintf_comment(f, fmt, ap);
+	qdf_vprintf_comment(sink, fmt, ap);
 	va_end(ap);
 }
 
 void
-qdf_print_object(FILE *f, const struct qdf_object *o)
+qdf_print_object(struct qdf_sink *sink, const struct qdf_object *o)
 {
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(o != NULL);
 
 	switch (o->type) {
-	case QDF_TYPE_NULL:   qdf_print_token(f, & (struct token) { TOK_NULL                        }); return;
-	case QDF_TYPE_BOOL:   qdf_print_token(f, & (struct token) { TOK_BOOL,   .u.v    = o->u.v    }); return;
-	case QDF_TYPE_INT:    qdf_print_token(f, & (struct token) { TOK_INT,    .u.i    = o->u.i    }); return;
-	case QDF_TYPE_SIZE:   qdf_print_token(f, & (struct token) { TOK_SIZE,   .u.z    = o->u.z    }); return;
-	case QDF_TYPE_REAL:   qdf_print_token(f, & (struct token) { TOK_REAL,   .u.n    = o->u.n    }); return;
-	case QDF_TYPE_STRING: qdf_print_token(f, & (struct token) { TOK_STRING, .u.s    = o->u.s    }); return;
-	case QDF_TYPE_BIN:    qdf_print_token(f, & (struct token) { TOK_BIN,    .u.data = o->u.data }); return;
-	case QDF_TYPE_NAME:   qdf_print_token(f, & (struct token) { TOK_NAME,   .u.name = o->u.name }); return;
-
-	case QDF_TYPE_ARRAY:  qdf_print_array (f, &o->u.a);  return;
-	case QDF_TYPE_DICT:   qdf_print_dict  (f, &o->u.d);  return;
-	case QDF_TYPE_STREAM: qdf_print_stream(f, &o->u.st); return;
+	case QDF_TYPE_NULL:     qdf_print_token(sink, & (struct token) { TOK_NULL                                         }); return;
+	case QDF_TYPE_BOOL:     qdf_print_token(sink, & (struct token) { TOK_BOOL,   .u.v    = o->u.v                     }); return;
+	case QDF_TYPE_INT:      qdf_print_token(sink, & (struct token) { TOK_INT,    .u.i    = o->u.i                     }); return;
+	case QDF_TYPE_SIZE:     qdf_print_token(sink, & (struct token) { TOK_SIZE,   .u.z    = o->u.z                     }); return;
+	case QDF_TYPE_REAL:     qdf_print_token(sink, & (struct token) { TOK_REAL,   .u.n    = o->u.n                     }); return;
+	case QDF_TYPE_STRING:   qdf_print_token(sink, & (struct token) { TOK_STRING, .u.data = { o->u.s, strlen(o->u.s) } }); return;
+	case QDF_TYPE_STRING_N: qdf_print_token(sink, & (struct token) { TOK_STRING, .u.data = o->u.data                  }); return;
+	case QDF_TYPE_BIN:      qdf_print_token(sink, & (struct token) { TOK_BIN,    .u.data = o->u.data                  }); return;
+	case QDF_TYPE_NAME:     qdf_print_token(sink, & (struct token) { TOK_NAME,   .u.name = o->u.name                  }); return;
+	case QDF_TYPE_REF:      qdf_print_token(sink, & (struct token) { TOK_REF,    .u.ref  = o->u.ref                   }); return;
+
+	case QDF_TYPE_ARRAY:    qdf_print_array (sink, &o->u.a);  return;
+	case QDF_TYPE_DICT:     qdf_print_dict  (sink, &o->u.d);  return;
+	case QDF_TYPE_STREAM:   qdf_print_stream(sink, &o->u.st); return;
 
 	default:
 		assert(!"unreached");
@@ -100,60 +109,65 @@ qdf_print_object(FILE *f, const struct qdf_object *o)
 }
 
 void
-qdf_print_def(FILE *f, unsigned id, const struct qdf_object *o)
+qdf_print_def(struct qdf_sink *sink, unsigned id, const struct qdf_object *o)
 {
 	const unsigned gen = 0;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(o != NULL);
 
-	qdf_print_token(f, & (struct token) { TOK_DEF_OPEN, .u.ref = { id, gen } });
-	qdf_print_object(f, o);
-	qdf_print_token(f, & (struct token) { TOK_DEF_CLOSE });
+	qdf_print_token(sink, & (struct token) { TOK_DEF_OPEN, .u.ref = { id, gen } });
+	qdf_print_object(sink, o);
+	qdf_print_token(sink, & (struct token) { TOK_DEF_CLOSE });
 }
 
 void
-qdf_print_array(FILE *f, const struct qdf_array *a)
+qdf_print_array(struct qdf_sink *sink, const struct qdf_array *a)
 {
 	size_t i;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(a != NULL);
 
-	qdf_print_token(f, & (struct token) { TOK_ARRAY_OPEN });
+	qdf_print_token(sink, & (struct token) { TOK_ARRAY_OPEN });
 
 	for (i = 0; i < a->n; i++) {
-		qdf_print_object(f, &a->o[i]);
+		qdf_print_object(sink, &a->o[i]);
 	}
 
-	qdf_print_token(f, & (struct token) { TOK_ARRAY_CLOSE });
+	qdf_print_token(sink, & (struct token) { TOK_ARRAY_CLOSE });
 }
 
-void
-qdf_print_dict(FILE *f, const struct qdf_dict *d)
+static void
+print_entries(struct qdf_sink *sink, const struct qdf_dict *d)
 {
-	size_t i, j;
+	size_t i;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(d != NULL);
 
-	qdf_print_token(f, & (struct token) { TOK_DICT_OPEN });
-
 	/* ISO PDF 2.0 7.3.7 "A dictonary whose value is null ... shall be
 	 * treated the same as if the entry does not exist." */
 
-	for (i = 0, j = 0; i < d->n; i++) {
+	for (i = 0; i < d->n; i++) {
 		if (d->e[i].o.type == QDF_TYPE_NULL) {
 			continue;
 		}
 
-		qdf_print_token(f, & (struct token) { TOK_NAME, .u.name = d->e[i].name });
-		qdf_print_object(f, &d->e[i].o);
-
-		j++;
+		qdf_print_token(sink, & (struct token) { TOK_NAME, .u.name = d->e[i].name });
+		qdf_print_object(sink, &d->e[i].o);
 	}
+}
 
-	qdf_print_token(f, & (struct token) { TOK_DICT_CLOSE });
+void
+qdf_print_dict(struct qdf_sink *sink, const struct qdf_dict *d)
+{
+	assert(sink != NULL);
+	assert(d != NULL);
+
+	qdf_print_token(sink, & (struct token) { TOK_DICT_OPEN });
+	print_entries(sink, d);
+	qdf_print_token(sink, & (struct token) { TOK_DICT_CLOSE });
 }
 
 static struct qdf_object
@@ -184,25 +198,47 @@ at_least_one_is_non_null(const struct qdf_object *a, size_t n)
 	return false;
 }
 
-static void
-qdf_print_stream_filters(FILE *f,
-	size_t length, const struct qdf_filter_array *a,
+static bool
+qdf_print_stream_filters(struct qdf_sink *sink,
+	const struct token *extra, size_t extran,
+	const struct qdf_object *length, const size_t *dl, const struct qdf_filter_array *a,
 	const char *filter_name, const char *decodeparams_name)
 {
-	struct qdf_entry e[3];
+	struct qdf_object *filters, *decodeparams;
+	struct qdf_entry *l, *p;
+	struct qdf_arena_mark m;
+	struct qdf_entry e[4];
 	size_t i;
 	size_t k;
 
-	assert(f != NULL);
+	assert(sink != NULL);
+	assert(extra != NULL || extran == 0);
+	assert(length != NULL);
+	assert(length->type == QDF_TYPE_SIZE || length->type == QDF_TYPE_REF);
 	assert(a != NULL);
 	assert(filter_name != NULL);
 	assert(decodeparams_name != NULL);
 
+	m = qdf_arena_mark(&sink->arena);
+
+	filters      = qdf_arena_calloc(&sink->arena, a->n, sizeof *filters);
+	decodeparams = qdf_arena_calloc(&sink->arena, a->n, sizeof *decodeparams);
+
+	/*
+	 * Storage for the elements within the /DecodeParms dict.
+	 * XXX: This is worst case; could count exactly
+	 */
+	l = qdf_arena_calloc(&sink->arena, a->n * QDF_PARAMS_MAX, sizeof *l);
+
+	if (filters == NULL || decodeparams == NULL || l == NULL) {
+		qdf_arena_release(&sink->arena, m);
+		return false;
+	}
+
 	k = 0;
 
-	e[k].name   = "Length";
-	e[k].o.type = QDF_TYPE_SIZE;
-	e[k].o.u.z  = length;
+	e[k].name = "Length";
+	e[k].o    = *length;
 
 	k++;
 
@@ -218,8 +254,6 @@ qdf_print_stream_filters(FILE *f,
 	 * be specified in the order in which they are to be applied.
 	 */
 
-	struct qdf_object filters[a->n];
-
 	for (i = 0; i < a->n; i++) {
 		filters[i].type   = QDF_TYPE_NAME;
 		filters[i].u.name = qdf_filter_name(a->a[i].type);
@@ -230,15 +264,6 @@ qdf_print_stream_filters(FILE *f,
 
 	k++;
 
-	struct qdf_object decodeparams[a->n];
-
-	/*
-	 * Storage for the elements within the /DecodeParms dict.
-	 * XXX: This is worst case; could count exactly
-	 */
-	struct qdf_entry l[a->n * QDF_PARAMS_MAX];
-	struct qdf_entry *p;
-
 	p = l;
 
 	/*
@@ -277,78 +302,307 @@ qdf_print_stream_filters(FILE *f,
 	}
 
 	/*
-	 * TODO: (optional)
 	 * ISO PDF 2.0 7.3.8.2 t5 /DL "A non-negative integer representing
 	 * the number of bytes in the decoded (defiltered) stream.
 	 * This value is only a hint; ..."
+	 *
+	 * Without filters it would only repeat /Length.
 	 */
 
+	if (a->n > 0 && dl != NULL) {
+		e[k].name   = "DL";
+		e[k].o.type = QDF_TYPE_SIZE;
+		e[k].o.u.z  = *dl;
+
+		k++;
+	}
+
 	/*
 	 * TODO: merge in a stream's own extra dict entries - I think each
-	 * stream can provide its own. Then check e[] for unique names
+	 * stream can provide its own. Then check e[] for unique names.
+	 * For now only the library's own streams have any (e.g. /Type /XRef),
+	 * given as tokens.
 	 */
 
-	qdf_print_dict(f, & (struct qdf_dict) { k, e });
+	qdf_print_token(sink, & (struct token) { TOK_DICT_OPEN });
+
+	for (i = 0; i < extran; i++) {
+		qdf_print_token(sink, &extra[i]);
+	}
+
+	print_entries(sink, & (struct qdf_dict) { k, e });
+	qdf_print_token(sink, & (struct token) { TOK_DICT_CLOSE });
+
+	qdf_arena_release(&sink->arena, m);
+
+	return true;
 }
 
+/* Passes data through to a chain, counting it for /DL */
+struct feed {
+	struct qdf_filter_chain *c;
+	size_t n;
+};
+
 static bool
-qdf_print_filter_encoded(FILE *f,
-	const void *p, size_t n,
-	const struct qdf_filter_array *a)
+feed_emit(void *opaque, const void *p, size_t n)
 {
-	size_t i;
+	struct feed *f = opaque;
 
 	assert(f != NULL);
-	assert(p != NULL);
-	assert(a != NULL);
 
-	for (i = 0; i < a->n; i++) {
-		const void *out;
-		size_t outsz;
-		bool r;
+	f->n += n;
+
+	return filter_chain_update(f->c, p, n);
+}
+
+/* Stream data straight to the sink */
+static bool
+raw_emit(void *opaque, const void *p, size_t n)
+{
+	struct qdf_sink *sink = opaque;
+
+	assert(sink != NULL);
+
+	qdf_print_token(sink, & (struct token) { TOK_RAW, .u.data = { p, n } });
+
+	/* stop early rather than produce the rest for a failed sink */
+	if (sink->err != 0) {
+		errno = sink->err;
+		return false;
+	}
+
+	return true;
+}
+
+bool
+qdf_print_stream_with(struct qdf_sink *sink,
+	const struct token *extra, size_t extran,
+	const struct qdf_stream *st)
+{
+	const struct qdf_filter_array none = { 0, NULL };
+	const struct qdf_filter_array *enc;
+	struct filter_buf b = { NULL, 0, 0 };
+	struct qdf_filter_chain c;
+	struct feed f;
+	const void *p;
+	size_t n, dl;
+	bool r;
+
+	assert(sink != NULL);
+	assert(st != NULL);
+
+	/* pre-encoded data passes through, and its decoded length is unknown */
+	enc = st->encoded ? &none : &st->filters;
+
+	/*
+	 * Data with nothing to encode and a known length needs nothing held;
+	 * it's printed as it's read. A file goes to a file descriptor sink
+	 * without passing through userspace at all. If reading fails part way,
+	 * the output is incomplete.
+	 */
+	if (st->src != NULL && enc->n == 0 && source_length(st->src, &n)) {
+		if (!qdf_print_stream_filters(sink, extra, extran,
+			& (struct qdf_object) { QDF_TYPE_SIZE, .u.z = n }, st->encoded ? NULL : &n, &st->filters,
+			"Filter", "DecodeParms")) {
+			return false;
+		}
 
-		r = qdf_filter_encode(&a->a[i], p, n, &out, &outsz);
+		qdf_print_token(sink, & (struct token) { TOK_STREAM_OPEN });
 
-		if (i > 0) {
-			free((void *) p);
+		if (st->src->type == QDF_SOURCE_FD) {
+			r = sink_copy_fd(sink, st->src->u.fd.fd, st->src->u.fd.offset, st->src->u.fd.len);
+		} else {
+			r = source_pump(st->src, &sink->arena, raw_emit, sink);
 		}
 
 		if (!r) {
 			return false;
 		}
 
-		p = out;
-		n = outsz;
+		qdf_print_token(sink, & (struct token) { TOK_STREAM_CLOSE });
+
+		return true;
 	}
 
-	qdf_print_token(f, & (struct token) { TOK_RAW, .u.data = { p, n } });
+	/*
+	 * Otherwise the stream's dict needs the encoded length, so the encoded
+	 * data is produced before anything is printed. Sources are read and the
+	 * filters pass bounded chunks between them, and only the final output
+	 * is held in full. See qdf_stream_begin() to avoid that, as
+	 * qdf_doc_def() does for sources.
+	 */
+	if (st->src == NULL && enc->n == 0) {
+		p  = st->data.p;
+		n  = st->data.n;
+		dl = n;
+	} else {
+		if (!filter_chain_init(&c, enc, filter_collect, &b)) {
+			return false;
+		}
+
+		if (st->src != NULL) {
+			f.c = &c;
+			f.n = 0;
+
+			r  = source_pump(st->src, &sink->arena, feed_emit, &f);
+			dl = f.n;
+		} else {
+			r  = filter_chain_update(&c, st->data.p, st->data.n);
+			dl = st->data.n;
+		}
 
-	if (i > 0) {
-		free((void *) p);
+		if (!r || !filter_chain_finish(&c)) {
+			filter_chain_fini(&c);
+			free(b.p);
+			return false;
+		}
+
+		filter_chain_fini(&c);
+
+		p = b.p;
+		n = b.n;
+	}
+
+	if (!qdf_print_stream_filters(sink, extra, extran,
+		& (struct qdf_object) { QDF_TYPE_SIZE, .u.z = n }, st->encoded ? NULL : &dl, &st->filters,
+		"Filter", "DecodeParms")) {
+		free(b.p);
+		return false;
 	}
 
+	qdf_print_token(sink, & (struct token) { TOK_STREAM_OPEN });
+	qdf_print_token(sink, & (struct token) { TOK_RAW, .u.data = { p, n } });
+	qdf_print_token(sink, & (struct token) { TOK_STREAM_CLOSE });
+
+	free(b.p);
+
 	return true;
 }
 
 bool
-qdf_print_stream(FILE *f, const struct qdf_stream *st)
+qdf_print_stream(struct qdf_sink *sink, const struct qdf_stream *st)
 {
-	assert(f != NULL);
-	assert(st != NULL);
+	return qdf_print_stream_with(sink, NULL, 0, st);
+}
+
+/* Encoded output goes straight to the sink, counted on the way */
+static bool
+writer_emit(void *opaque, const void *p, size_t n)
+{
+	struct qdf_stream_writer *w = opaque;
+
+	assert(w != NULL);
+	assert(w->sink != NULL);
+
+	w->length += n;
+
+	return raw_emit(w->sink, p, n);
+}
+
+bool
+qdf_stream_begin(struct qdf_stream_writer *w, struct qdf_sink *sink,
+	unsigned id, unsigned length_id, const struct qdf_filter_array *filters)
+{
+	const unsigned gen = 0;
+
+	assert(w != NULL);
+	assert(sink != NULL);
+	assert(filters != NULL);
+	assert(id != length_id);
+
+	w->sink      = sink;
+	w->length_id = length_id;
+	w->length    = 0;
+
+	w->chain = malloc(sizeof *w->chain);
+	if (w->chain == NULL) {
+		return false;
+	}
+
+	if (!filter_chain_init(w->chain, filters, writer_emit, w)) {
+		free(w->chain);
+		w->chain = NULL;
+		return false;
+	}
+
+	qdf_print_token(sink, & (struct token) { TOK_DEF_OPEN, .u.ref = { id, gen } });
+
+	/* the decoded length isn't known yet either, so there's no /DL */
+	if (!qdf_print_stream_filters(sink, NULL, 0,
+		& (struct qdf_object) { QDF_TYPE_REF, .u.ref = { length_id, gen } }, NULL, filters,
+		"Filter", "DecodeParms")) {
+		filter_chain_fini(w->chain);
+		free(w->chain);
+		w->chain = NULL;
+		return false;
+	}
 
-	/* XXX: /Length is incorrect here; it should be the *encoded* length */
-	qdf_print_stream_filters(f,
-		st->data.n, &st->filters,
-		"Filter", "DecodeParams");
+	qdf_print_token(sink, & (struct token) { TOK_STREAM_OPEN });
 
-	qdf_print_token(f, & (struct token) { TOK_STREAM_OPEN });
+	return true;
+}
 
-	if (!qdf_print_filter_encoded(f, st->data.p, st->data.n, &st->filters)) {
+bool
+qdf_stream_write(struct qdf_stream_writer *w, const void *p, size_t n)
+{
+	assert(w != NULL);
+	assert(w->chain != NULL);
+	assert(p != NULL || n == 0);
+
+	return filter_chain_update(w->chain, p, n);
+}
+
+static bool
+source_emit(void *opaque, const void *p, size_t n)
+{
+	return qdf_stream_write(opaque, p, n);
+}
+
+bool
+qdf_stream_write_source(struct qdf_stream_writer *w, const struct qdf_source *src)
+{
+	assert(w != NULL);
+	assert(w->chain != NULL);
+	assert(src != NULL);
+
+	return source_pump(src, &w->sink->arena, source_emit, w);
+}
+
+bool
+qdf_stream_close(struct qdf_stream_writer *w)
+{
+	bool r;
+
+	assert(w != NULL);
+	assert(w->chain != NULL);
+
+	r = filter_chain_finish(w->chain);
+
+	filter_chain_fini(w->chain);
+	free(w->chain);
+	w->chain = NULL;
+
+	if (!r) {
 		return false;
 	}
 
-	qdf_print_token(f, & (struct token) { TOK_STREAM_CLOSE });
+	qdf_print_token(w->sink, & (struct token) { TOK_STREAM_CLOSE });
+	qdf_print_token(w->sink, & (struct token) { TOK_DEF_CLOSE });
 
 	return true;
 }
 
+bool
+qdf_stream_end(struct qdf_stream_writer *w)
+{
+	assert(w != NULL);
+
+	if (!qdf_stream_close(w)) {
+		return false;
+	}
+
+	qdf_print_def(w->sink, w->length_id, & (struct qdf_object) { QDF_TYPE_SIZE, .u.z = w->length });
+
+	return true;
+}
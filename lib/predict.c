@@ -0,0 +1,737 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+
+#include "filter.h"
+#include "predict.h"
+
+/*
+ * ISO PDF 2.0 7.4.4.4 LZW and Flate predictor functions. Predictor 2 is
+ * TIFF horizontal differencing per component, and 10 to 15 are the PNG
+ * filters, each row prefixed by a byte giving its filter type. For PNG,
+ * the predictor chooses the type when encoding, with 15 choosing per row;
+ * when decoding, each row's own type byte is used.
+ */
+enum {
+	PREDICT_NONE  = 1,
+	PREDICT_TIFF  = 2,
+	PREDICT_PNG   = 10, /* + enum png_type */
+	PREDICT_OPTIM = 15
+};
+
+enum png_type {
+	PNG_NONE,
+	PNG_SUB,
+	PNG_UP,
+	PNG_AVERAGE,
+	PNG_PAETH,
+	PNG_TYPES
+};
+
+/* Arbitrary, to keep row sizes well away from overflow */
+#define PREDICT_COLORS_MAX 256
+
+struct predict {
+	int predictor;
+	unsigned colors;
+	unsigned bpc;
+	size_t rowlen; /* bytes per row, excluding the PNG type */
+	size_t bpp;    /* bytes per pixel, rounded up, for PNG */
+
+	/*
+	 * Each row is 1 + rowlen bytes, with pixels from offset 1. The first
+	 * byte is the PNG type where there is one. prior is zero initially.
+	 * All are allocated together, at buf.
+	 */
+	unsigned char *buf;
+	unsigned char *row;
+	unsigned char *prior;
+	unsigned char *filt; /* encoding: candidates, one per type for 15 */
+	size_t fill;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+bool
+predict_needed(const struct qdf_filter *f)
+{
+	assert(f != NULL);
+
+	if (f->type != QDF_FILTER_LZW && f->type != QDF_FILTER_FLATE) {
+		return false;
+	}
+
+	return f->u.lzw_flate.predictor != PREDICT_NONE;
+}
+
+static unsigned char
+paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+	int pa, pb, pc;
+
+	pa = abs(b - c);
+	pb = abs(a - c);
+	pc = abs(a + b - c - c);
+
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+
+	return pb <= pc ? b : c;
+}
+
+/*
+ * The PNG filters for encoding. Every byte depends only on the raw row
+ * and the raw prior row, so these are vectorized across the whole row.
+ * Bytes within the first pixel have no left neighbour, and are done
+ * separately. Decoding depends on the previous pixel's decoded value,
+ * and so remains serial.
+ */
+
+static void
+png_sub(unsigned char *dst, const unsigned char *x, size_t n, size_t bpp)
+{
+	size_t i;
+
+	for (i = 0; i < n && i < bpp; i++) {
+		dst[i] = x[i];
+	}
+
+#if defined(__SSE2__)
+	for ( ; i + 16 <= n; i += 16) {
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sub_epi8(
+			_mm_loadu_si128((const __m128i *) (x + i)),
+			_mm_loadu_si128((const __m128i *) (x + i - bpp))));
+	}
+#endif
+
+	for ( ; i < n; i++) {
+		dst[i] = x[i] - x[i - bpp];
+	}
+}
+
+static void
+png_up(unsigned char *dst, const unsigned char *x, const unsigned char *prior, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for ( ; i + 16 <= n; i += 16) {
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sub_epi8(
+			_mm_loadu_si128((const __m128i *) (x + i)),
+			_mm_loadu_si128((const __m128i *) (prior + i))));
+	}
+#endif
+
+	for ( ; i < n; i++) {
+		dst[i] = x[i] - prior[i];
+	}
+}
+
+static void
+png_average(unsigned char *dst, const unsigned char *x, const unsigned char *prior, size_t n, size_t bpp)
+{
+	size_t i;
+
+	for (i = 0; i < n && i < bpp; i++) {
+		dst[i] = x[i] - (prior[i] >> 1);
+	}
+
+#if defined(__SSE2__)
+	for ( ; i + 16 <= n; i += 16) {
+		__m128i a, b, avg;
+
+		a = _mm_loadu_si128((const __m128i *) (x + i - bpp));
+		b = _mm_loadu_si128((const __m128i *) (prior + i));
+
+		/* _mm_avg_epu8() rounds up, where PNG rounds down */
+		avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+			_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sub_epi8(
+			_mm_loadu_si128((const __m128i *) (x + i)), avg));
+	}
+#endif
+
+	for ( ; i < n; i++) {
+		dst[i] = x[i] - ((x[i - bpp] + prior[i]) >> 1);
+	}
+}
+
+#if defined(__SSE2__)
+
+static __m128i
+abs_epi16(__m128i v)
+{
+	return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+/* paeth() for eight lanes of 16 bits */
+static __m128i
+paeth_epi16(__m128i a, __m128i b, __m128i c)
+{
+	__m128i pa, pb, pc, not_a, not_b;
+
+	pa = abs_epi16(_mm_sub_epi16(b, c));
+	pb = abs_epi16(_mm_sub_epi16(a, c));
+	pc = abs_epi16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));
+
+	not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	not_b = _mm_cmpgt_epi16(pb, pc);
+
+	b = _mm_or_si128(_mm_andnot_si128(not_b, b), _mm_and_si128(not_b, c));
+
+	return _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, b));
+}
+
+#endif
+
+static void
+png_paeth(unsigned char *dst, const unsigned char *x, const unsigned char *prior, size_t n, size_t bpp)
+{
+	size_t i;
+
+	/* with a and c both zero, the predictor is b */
+	for (i = 0; i < n && i < bpp; i++) {
+		dst[i] = x[i] - prior[i];
+	}
+
+#if defined(__SSE2__)
+	for ( ; i + 16 <= n; i += 16) {
+		const __m128i z = _mm_setzero_si128();
+		__m128i a, b, c, lo, hi;
+
+		a = _mm_loadu_si128((const __m128i *) (x + i - bpp));
+		b = _mm_loadu_si128((const __m128i *) (prior + i));
+		c = _mm_loadu_si128((const __m128i *) (prior + i - bpp));
+
+		lo = paeth_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z), _mm_unpacklo_epi8(c, z));
+		hi = paeth_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z), _mm_unpackhi_epi8(c, z));
+
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sub_epi8(
+			_mm_loadu_si128((const __m128i *) (x + i)), _mm_packus_epi16(lo, hi)));
+	}
+#endif
+
+	for ( ; i < n; i++) {
+		dst[i] = x[i] - paeth(x[i - bpp], prior[i], prior[i - bpp]);
+	}
+}
+
+/*
+ * The heuristic suggested by the PNG specification for choosing a filter
+ * type per row: the least sum of the filtered bytes' magnitudes, taking
+ * them as signed.
+ */
+static uint64_t
+png_cost(const unsigned char *p, size_t n)
+{
+	uint64_t sum = 0;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i z = _mm_setzero_si128();
+	__m128i acc = z;
+	uint64_t lane[2];
+
+	for ( ; i + 16 <= n; i += 16) {
+		__m128i v;
+
+		v = _mm_loadu_si128((const __m128i *) (p + i));
+		v = _mm_min_epu8(v, _mm_sub_epi8(z, v));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(v, z));
+	}
+
+	_mm_storeu_si128((__m128i *) lane, acc);
+	sum = lane[0] + lane[1];
+#endif
+
+	for ( ; i < n; i++) {
+		sum += p[i] < 0x80 ? p[i] : 0x100 - p[i];
+	}
+
+	return sum;
+}
+
+static void
+png_filter(unsigned char *dst, enum png_type type,
+	const unsigned char *x, const unsigned char *prior, size_t n, size_t bpp)
+{
+	switch (type) {
+	case PNG_NONE:    memcpy(dst, x, n);                   break;
+	case PNG_SUB:     png_sub(dst, x, n, bpp);             break;
+	case PNG_UP:      png_up(dst, x, prior, n);            break;
+	case PNG_AVERAGE: png_average(dst, x, prior, n, bpp);  break;
+	case PNG_PAETH:   png_paeth(dst, x, prior, n, bpp);    break;
+
+	default:
+		assert(!"unreached");
+	}
+}
+
+static bool
+png_unfilter(unsigned char *x, enum png_type type,
+	const unsigned char *prior, size_t n, size_t bpp)
+{
+	size_t i;
+
+	switch (type) {
+	case PNG_NONE:
+		break;
+
+	case PNG_SUB:
+		for (i = bpp; i < n; i++) {
+			x[i] += x[i - bpp];
+		}
+		break;
+
+	case PNG_UP:
+		for (i = 0; i < n; i++) {
+			x[i] += prior[i];
+		}
+		break;
+
+	case PNG_AVERAGE:
+		for (i = 0; i < n && i < bpp; i++) {
+			x[i] += prior[i] >> 1;
+		}
+		for ( ; i < n; i++) {
+			x[i] += (x[i - bpp] + prior[i]) >> 1;
+		}
+		break;
+
+	case PNG_PAETH:
+		for (i = 0; i < n && i < bpp; i++) {
+			x[i] += prior[i];
+		}
+		for ( ; i < n; i++) {
+			x[i] += paeth(x[i - bpp], prior[i], prior[i - bpp]);
+		}
+		break;
+
+	default:
+		errno = EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
+/* Components are packed big-endian, and rows are padded to a whole byte */
+static unsigned
+comp_get(const unsigned char *p, size_t j, unsigned bpc)
+{
+	size_t bit;
+
+	switch (bpc) {
+	case 8:  return p[j];
+	case 16: return p[2 * j] << 8 | p[2 * j + 1];
+
+	default:
+		bit = j * bpc;
+		return (p[bit / 8] >> (8 - bpc - bit % 8)) & ((1U << bpc) - 1);
+	}
+}
+
+static void
+comp_set(unsigned char *p, size_t j, unsigned bpc, unsigned v)
+{
+	unsigned shift, mask;
+	size_t bit;
+
+	switch (bpc) {
+	case 8:
+		p[j] = v;
+		break;
+
+	case 16:
+		p[2 * j]     = v >> 8;
+		p[2 * j + 1] = v;
+		break;
+
+	default:
+		bit   = j * bpc;
+		shift = 8 - bpc - bit % 8;
+		mask  = ((1U << bpc) - 1) << shift;
+		p[bit / 8] = (p[bit / 8] & ~mask) | ((v << shift) & mask);
+		break;
+	}
+}
+
+static void
+tiff_filter(unsigned char *dst, const unsigned char *x, size_t n, unsigned colors, unsigned bpc)
+{
+	size_t j, ncomp;
+
+	if (bpc == 8) {
+		png_sub(dst, x, n, colors);
+		return;
+	}
+
+	memcpy(dst, x, n);
+
+	ncomp = n * 8 / bpc;
+
+	for (j = colors; j < ncomp; j++) {
+		comp_set(dst, j, bpc, comp_get(x, j, bpc) - comp_get(x, j - colors, bpc));
+	}
+}
+
+static void
+tiff_unfilter(unsigned char *x, size_t n, unsigned colors, unsigned bpc)
+{
+	size_t j, ncomp;
+
+	ncomp = n * 8 / bpc;
+
+	for (j = colors; j < ncomp; j++) {
+		comp_set(x, j, bpc, comp_get(x, j, bpc) + comp_get(x, j - colors, bpc));
+	}
+}
+
+static bool
+predict_put(struct filter_stage *st, struct predict *pr, const unsigned char *p, size_t n)
+{
+	assert(st != NULL);
+	assert(pr != NULL);
+
+	if (n > sizeof pr->out - pr->n) {
+		if (pr->n > 0 && !st->emit(st->opaque, pr->out, pr->n)) {
+			return false;
+		}
+
+		pr->n = 0;
+	}
+
+	if (n > sizeof pr->out) {
+		return st->emit(st->opaque, p, n);
+	}
+
+	memcpy(pr->out + pr->n, p, n);
+	pr->n += n;
+
+	return true;
+}
+
+static bool
+predict_flush(struct filter_stage *st, struct predict *pr)
+{
+	assert(st != NULL);
+	assert(pr != NULL);
+
+	if (pr->n == 0) {
+		return true;
+	}
+
+	if (!st->emit(st->opaque, pr->out, pr->n)) {
+		return false;
+	}
+
+	pr->n = 0;
+
+	return true;
+}
+
+static bool
+predict_init(struct filter_stage *st, unsigned candidates)
+{
+	const struct qdf_param_lzw_flate *p;
+	struct predict *pr;
+	size_t rowsz;
+
+	assert(st != NULL);
+	assert(st->f != NULL);
+
+	p = &st->f->u.lzw_flate;
+
+	if (p->predictor != PREDICT_TIFF && (p->predictor < PREDICT_PNG || p->predictor > PREDICT_OPTIM)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	switch (p->bits_per_component) {
+	case 1: case 2: case 4: case 8: case 16:
+		break;
+
+	default:
+		errno = EINVAL;
+		return false;
+	}
+
+	if (p->colors < 1 || p->colors > PREDICT_COLORS_MAX || p->columns < 1) {
+		errno = EINVAL;
+		return false;
+	}
+
+	/* the bits per row, and so the row size, fit comfortably */
+	if ((uint_fast64_t) p->columns > (SIZE_MAX / 4 - 8) / ((size_t) p->colors * p->bits_per_component)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	pr = malloc(sizeof *pr);
+	if (pr == NULL) {
+		return false;
+	}
+
+	pr->predictor = p->predictor;
+	pr->colors    = p->colors;
+	pr->bpc       = p->bits_per_component;
+	pr->rowlen    = ((size_t) p->colors * p->bits_per_component * p->columns + 7) / 8;
+	pr->bpp       = ((size_t) p->colors * p->bits_per_component + 7) / 8;
+	pr->fill      = 0;
+	pr->n         = 0;
+
+	rowsz = 1 + pr->rowlen;
+
+	pr->buf = calloc(2 + candidates, rowsz);
+	if (pr->buf == NULL) {
+		free(pr);
+		return false;
+	}
+
+	pr->row   = pr->buf;
+	pr->prior = pr->buf + rowsz;
+	pr->filt  = pr->buf + rowsz * 2;
+
+	st->state = pr;
+
+	return true;
+}
+
+static bool
+predict_enc_init(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return predict_init(st, st->f->u.lzw_flate.predictor == PREDICT_OPTIM ? PNG_TYPES : 1);
+}
+
+/* Filters n bytes of the row, which is complete unless it's the last */
+static bool
+predict_enc_row(struct filter_stage *st, struct predict *pr, size_t n)
+{
+	const unsigned char *x, *prior;
+	unsigned char *dst;
+	uint64_t cost, best;
+	enum png_type type;
+	size_t rowsz;
+
+	assert(st != NULL);
+	assert(pr != NULL);
+
+	x     = pr->row + 1;
+	prior = pr->prior + 1;
+
+	if (pr->predictor == PREDICT_TIFF) {
+		tiff_filter(pr->filt, x, n, pr->colors, pr->bpc);
+		return predict_put(st, pr, pr->filt, n);
+	}
+
+	if (pr->predictor != PREDICT_OPTIM) {
+		type = pr->predictor - PREDICT_PNG;
+
+		pr->filt[0] = type;
+		png_filter(pr->filt + 1, type, x, prior, n, pr->bpp);
+
+		return predict_put(st, pr, pr->filt, 1 + n);
+	}
+
+	rowsz = 1 + pr->rowlen;
+	dst   = pr->filt;
+	best  = UINT64_MAX;
+
+	for (type = PNG_NONE; type < PNG_TYPES; type++) {
+		unsigned char *cand = pr->filt + type * rowsz;
+
+		cand[0] = type;
+		png_filter(cand + 1, type, x, prior, n, pr->bpp);
+
+		cost = png_cost(cand + 1, n);
+		if (cost < best) {
+			best = cost;
+			dst  = cand;
+		}
+	}
+
+	return predict_put(st, pr, dst, 1 + n);
+}
+
+static bool
+predict_enc_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct predict *pr;
+	unsigned char *tmp;
+	size_t k;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	pr = st->state;
+
+	while (n > 0) {
+		k = pr->rowlen - pr->fill < n ? pr->rowlen - pr->fill : n;
+		memcpy(pr->row + 1 + pr->fill, s, k);
+		pr->fill += k;
+		s += k;
+		n -= k;
+
+		if (pr->fill < pr->rowlen) {
+			break;
+		}
+
+		if (!predict_enc_row(st, pr, pr->rowlen)) {
+			return false;
+		}
+
+		tmp       = pr->prior;
+		pr->prior = pr->row;
+		pr->row   = tmp;
+		pr->fill  = 0;
+	}
+
+	return true;
+}
+
+static bool
+predict_enc_finish(struct filter_stage *st)
+{
+	struct predict *pr;
+
+	assert(st != NULL);
+
+	pr = st->state;
+
+	/* a partial last row is filtered as far as it goes */
+	if (pr->fill > 0 && !predict_enc_row(st, pr, pr->fill)) {
+		return false;
+	}
+
+	return predict_flush(st, pr);
+}
+
+static void
+predict_fini(struct filter_stage *st)
+{
+	struct predict *pr;
+
+	assert(st != NULL);
+
+	pr = st->state;
+
+	free(pr->buf);
+	free(pr);
+}
+
+static bool
+predict_dec_init(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	return predict_init(st, 0);
+}
+
+/* Decodes the row in place, given n bytes including any PNG type */
+static bool
+predict_dec_row(struct filter_stage *st, struct predict *pr, size_t n)
+{
+	assert(st != NULL);
+	assert(pr != NULL);
+
+	if (pr->predictor == PREDICT_TIFF) {
+		tiff_unfilter(pr->row + 1, n, pr->colors, pr->bpc);
+		return predict_put(st, pr, pr->row + 1, n);
+	}
+
+	if (!png_unfilter(pr->row + 1, pr->row[0], pr->prior + 1, n - 1, pr->bpp)) {
+		return false;
+	}
+
+	return predict_put(st, pr, pr->row + 1, n - 1);
+}
+
+static bool
+predict_dec_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct predict *pr;
+	unsigned char *tmp;
+	size_t k, off, rowsz;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	pr = st->state;
+
+	/* TIFF rows have no type, and are read from offset 1 regardless */
+	off   = pr->predictor == PREDICT_TIFF;
+	rowsz = 1 + pr->rowlen - off;
+
+	while (n > 0) {
+		k = rowsz - pr->fill < n ? rowsz - pr->fill : n;
+		memcpy(pr->row + off + pr->fill, s, k);
+		pr->fill += k;
+		s += k;
+		n -= k;
+
+		if (pr->fill < rowsz) {
+			break;
+		}
+
+		if (!predict_dec_row(st, pr, rowsz)) {
+			return false;
+		}
+
+		tmp       = pr->prior;
+		pr->prior = pr->row;
+		pr->row   = tmp;
+		pr->fill  = 0;
+	}
+
+	return true;
+}
+
+static bool
+predict_dec_finish(struct filter_stage *st)
+{
+	struct predict *pr;
+
+	assert(st != NULL);
+
+	pr = st->state;
+
+	if (pr->fill > 0 && !predict_dec_row(st, pr, pr->fill)) {
+		return false;
+	}
+
+	return predict_flush(st, pr);
+}
+
+const struct filter_ops predict_enc = {
+	predict_enc_init, predict_enc_update, predict_enc_finish, predict_fini
+};
+
+const struct filter_ops predict_dec = {
+	predict_dec_init, predict_dec_update, predict_dec_finish, predict_fini
+};
+
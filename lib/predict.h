@@ -0,0 +1,23 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_PREDICT_INTERNAL_H
+#define LIBQDF_PREDICT_INTERNAL_H
+
+/*
+ * Stages for the /Predictor of an LZWDecode or FlateDecode filter,
+ * taking parameters from the stage's qdf_filter. For encoding these come
+ * before the filter's own stage, and for decoding after it.
+ */
+extern const struct filter_ops predict_enc;
+extern const struct filter_ops predict_dec;
+
+/* Whether f has a predictor other than 1, which needs a stage of its own */
+bool
+predict_needed(const struct qdf_filter *f);
+
+#endif
+
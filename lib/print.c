@@ -4,6 +4,8 @@
  * See LICENCE for the full copyright terms.
  */
 
+#include <sys/types.h>
+
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -14,286 +16,568 @@
 #include <inttypes.h>
 #include <float.h>
 #include <ctype.h>
+#include <errno.h>
 #include <math.h>
 
 #include <qdf/version.h>
 #include <qdf/types.h>
+#include <qdf/arena.h>
+#include <qdf/sink.h>
 
 #include "token.h"
+#include "sink.h"
+#include "hex.h"
+#include "fmt.h"
+#include "name.h"
+
+static void
+print_int(struct qdf_sink *sink, intmax_t i)
+{
+	assert(sink != NULL);
+
+	sink_commit(sink, fmt_int((char *) sink_reserve(sink, FMT_INT_MAX), i));
+}
+
+static void
+print_uint(struct qdf_sink *sink, uintmax_t u)
+{
+	assert(sink != NULL);
+
+	sink_commit(sink, fmt_uint((char *) sink_reserve(sink, FMT_INT_MAX), u));
+}
 
+/* "N G R" and "N G obj" */
 static void
-print_comment(FILE *f, const char *s)
+print_ref(struct qdf_sink *sink, const struct qdf_ref *ref, const char *kw)
 {
-	assert(f != NULL);
-	assert(s = NULL);
+	const size_t kwlen = strlen(kw);
+	unsigned char *q;
+	size_t n;
+
+	assert(sink != NULL);
+	assert(ref != NULL);
+	assert(kwlen < QDF_SINK_MIN - 2 * FMT_INT_MAX);
+
+	/* the offset is taken before sink_reserve() might drain the buffer */
+	if (!sink_note_ref(sink, qdf_sink_offset(sink), ref->id)) {
+		if (sink->err == 0) {
+			sink->err = errno != 0 ? errno : EIO;
+		}
+	}
+
+	q = sink_reserve(sink, 2 * FMT_INT_MAX + 1 + kwlen);
+
+	n  = fmt_uint((char *) q, ref->id);
+	q[n++] = ' ';
+	n += fmt_uint((char *) q + n, ref->gen);
+	memcpy(q + n, kw, kwlen);
+
+	sink_commit(sink, n + kwlen);
+}
+
+static void
+print_comment(struct qdf_sink *sink, const char *s)
+{
+	assert(sink != NULL);
+	assert(s != NULL);
 
 	/* XXX: disallow special characters */
-	fprintf(f, "%% %s\n", s);
+	sink_puts(sink, "% ");
+	sink_puts(sink, s);
+	sink_putc(sink, '\n');
 }
 
+/*
+ * ISO PDF 2.0 7.5.2 "The first line of a PDF file shall be a header
+ * consisting of the 5 characters %PDF- followed by a version number ..."
+ * and "If a PDF file contains binary data, ... the header line shall be
+ * immediately followed by a comment line containing at least four binary
+ * characters", so that it isn't taken for text in transfer.
+ */
 static void
-print_real(FILE *f, qdf_real n)
+print_ver(struct qdf_sink *sink, enum qdf_version ver)
 {
-	const int precision = 8;
-	double i, b; /* not qdf_real; for modf() and friends */
+	const char *s;
+
+	assert(sink != NULL);
+
+	switch (ver) {
+	case QDF_VER_1_2:       s = "1.2"; break;
+	case QDF_VER_1_3:       s = "1.3"; break;
+	case QDF_VER_1_4:       s = "1.4"; break;
+	case QDF_VER_1_5:       s = "1.5"; break;
+	case QDF_VER_1_6:       s = "1.6"; break;
+
+	/* extension levels are given by the catalog's /Extensions */
+	case QDF_VER_1_7:
+	case QDF_VER_1_7_EXT_3:
+	case QDF_VER_1_7_EXT_5: s = "1.7"; break;
+
+	case QDF_VER_2_0:       s = "2.0"; break;
+
+	default:
+		assert(!"unreached");
+		abort();
+	}
 
-	assert(f != NULL);
+	sink_puts(sink, "%PDF-");
+	sink_puts(sink, s);
+	sink_puts(sink, "\n%\xE2\xE3\xCF\xD3\n");
+}
+
+static void
+print_real(struct qdf_sink *sink, qdf_real n)
+{
+	assert(sink != NULL);
 	assert(!isnan(n));
 	assert(!isinf(n));
 
 	if (isnan(n) || isinf(n)) {
-		fprintf(f, "0");
+		sink_putc(sink, '0');
 		return;
 	}
 
-	/* ISO PDF 2.0 7.33 "A PDF writer shall not use the PostScript language
-	 * syntax for numbers with non-decimal radicies (such as 16#FFFE) or in
-	 * exponential format (such as 6.02E23)." */
-
-	b = modf(n, &i);
-
 	/* ISO PDF 2.0 7.3.3 "Wherever a real number is expected, an integer
-	 * may be used instead."
-	 *
-	 * Note this may be out of range for qdf_print_int()'s integer type.
-	 */
-	if (b == 0.0) {
-		fprintf(f, "%.0f", i);
-		return;
-	}
+	 * may be used instead." fmt_real() omits the point for integral
+	 * values. */
+	sink_commit(sink, fmt_real((char *) sink_reserve(sink, FMT_REAL_MAX), n, sink->precision));
+}
 
-	if (i == 0.0) {
-		char buf[2 + 149 + 1];
-		char *p;
-		size_t r;
+/*
+ * ISO PDF 2.0 7.3.4.2 Literal strings. Bytes which need attention are
+ * found by table lookup, and runs of the rest are copied as-is.
+ */
+#define _ STR_COPY
+#define P STR_PAREN
+#define E STR_ESC
+#define O STR_OCTAL
+enum { STR_COPY, STR_PAREN, STR_ESC, STR_OCTAL };
+static const unsigned char str_class[256] = {
+	O, O, O, O, O, O, O, O, E, E, E, O, E, E, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	_, _, _, _, _, _, _, _, P, P, _, _, _, _, _, _,
+	_, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+	_, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+	_, _, _, _, _, _, _, _, _, _, _, _, E, _, _, _,
+	_, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,
+	_, _, _, _, _, _, _, _, _, _, _, _, _, _, _, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+	O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+};
+#undef _
+#undef P
+#undef E
+#undef O
 
-		r = snprintf(buf, sizeof buf, "%.*f", precision, fabs(b));
-		assert(r < sizeof buf);
-		assert(buf[0] == '0');
-		assert(buf[1] == '.');
+/*
+ * ISO PDF 2.0 7.3.4.2 "Balanced pairs of parentheses ... require no special
+ * treatment." Unbalanced parentheses must be escaped.
+ *
+ * Parentheses match greedily, so a ')' is unbalanced exactly when
+ * no '(' is open at that point, which is known when printing.
+ * An unbalanced '(' is one left open at the end; there are as many of
+ * these as the depth after a forward pass, and they all follow the last
+ * unbalanced ')'. So they can be found by walking back from the end until
+ * that many have been seen. Their positions are stored ascending in u[].
+ */
+static size_t
+count_unbalanced(const unsigned char *s, size_t n)
+{
+	size_t i, depth;
 
-		p = buf + strlen(buf) - 1;
-		while (p >= buf && *p == '0') {
-			*p = '\0';
-			p--;
-		}
+	depth = 0;
 
-		fprintf(f, "%s.%s",
-			signbit(b) ? "-" : "",
-			buf + 2);
-		return;
+	for (i = 0; i < n; i++) {
+		if (s[i] == '(') {
+			depth++;
+		} else if (s[i] == ')' && depth > 0) {
+			depth--;
+		}
 	}
 
-	fprintf(f, "%.*" QDF_PRIr, precision, n);
+	return depth;
 }
 
-static bool
-balanced(const char *s)
+static void
+find_unbalanced(const unsigned char *s, size_t n, size_t u[], size_t count)
 {
-	const char *p;
-	int depth;
+	size_t i, pending;
 
-	depth = 0;
+	pending = 0;
 
-	for (p = s; *p != '\0'; p++) {
-		switch (*p) {
-		case '(': depth++; break;
-		case ')': depth--; break;
-
-		default:
-			;
-		}
+	for (i = n; count > 0; i--) {
+		assert(i > 0);
 
-		if (depth == 0) {
-			return true;
+		if (s[i - 1] == ')') {
+			pending++;
+		} else if (s[i - 1] == '(') {
+			if (pending == 0) {
+				u[--count] = i - 1;
+			} else {
+				pending--;
+			}
 		}
 	}
+}
 
-	return false;
+static void
+print_octal(struct qdf_sink *sink, unsigned char c, bool pad)
+{
+	unsigned char *q;
+	size_t n;
+
+	q = sink_reserve(sink, 4);
+	n = 0;
+
+	q[n++] = '\\';
+
+	/* ISO PDF 2.0 7.3.4.2 "Three octal digits shall be used,
+	 * with leading zeroes as needed, if the next character of
+	 * the string is also a digit." */
+	if (pad || c >= 0100) q[n++] = '0' + (c >> 6);
+	if (pad || c >= 0010) q[n++] = '0' + (c >> 3 & 7);
+	q[n++] = '0' + (c & 7);
+
+	sink_commit(sink, n);
 }
 
 static void
-print_string(FILE *f, const char *s)
+print_string(struct qdf_sink *sink, const void *s, size_t n)
 {
-	const int limit = 70;
-	const char *p;
-	int depth;
+	const size_t limit = 70;
+	const unsigned char *p = s;
+	struct qdf_arena_mark m;
+	size_t ubuf[32], *u;
+	size_t i, j, split;
+	size_t ucount, unext;
+	size_t depth;
 
-	assert(f != NULL);
-	assert(s != NULL);
+	assert(sink != NULL);
+	assert(s != NULL || n == 0);
+
+	ucount = count_unbalanced(p, n);
+	unext  = 0;
+	u      = ubuf;
+
+	m = qdf_arena_mark(&sink->arena);
+
+	if (ucount > sizeof ubuf / sizeof *ubuf) {
+		u = qdf_arena_calloc(&sink->arena, ucount, sizeof *u);
+	}
 
-	fprintf(f, "(");
+	/* escaping every parenthesis is always valid, so ENOMEM is survivable */
+	if (u != NULL) {
+		find_unbalanced(p, n, u, ucount);
+	}
+
+	sink_putc(sink, '(');
 
 	depth = 0;
 
-	for (p = s; *p != '\0'; p++) {
-		/* ISO PDF 2.0 "A PDF writer may split a literal string
-		 * across multiple lines." */
-		if ((p - s + 1) % limit == 0) {
-			fprintf(f, "\\\n");
+	/* ISO PDF 2.0 "A PDF writer may split a literal string
+	 * across multiple lines." */
+	split = limit - 1;
+
+	for (i = 0; i < n; i++) {
+		if (i == split) {
+			sink_write(sink, "\\\n", 2);
+			split += limit;
 		}
 
-		/* ISO PDF 2.0 7.3.4.2 "Three octal digits shall be used,
-		 * with leading zeroes as needed, if the next character of
-		 * the string is also a digit." */
-		if (!isprint((unsigned char) *p)) {
-			fprintf(f, "\\%0*o",
-				isdigit((unsigned char) *(p + 1)) ? 3 : 0,
-				(unsigned char) *p);
+		for (j = i; j < n && j < split && str_class[p[j]] == STR_COPY; j++)
+			;
+
+		if (j > i) {
+			sink_write(sink, p + i, j - i);
+			i = j - 1;
 			continue;
 		}
 
-		switch (*p) {
-		case '\\': fprintf(f, "\\\\"); continue;
-		case '\n': fprintf(f, "\\n");  continue;
-		case '\r': fprintf(f, "\\r");  continue;
-		case '\t': fprintf(f, "\\t");  continue;
-		case '\b': fprintf(f, "\\b");  continue;
-		case '\f': fprintf(f, "\\f");  continue;
+		switch (str_class[p[i]]) {
+		case STR_OCTAL:
+			print_octal(sink, p[i], i + 1 < n && p[i + 1] >= '0' && p[i + 1] <= '9');
+			continue;
 
-		/* ISO PDF 2.0 7.3.4.2 "Balanced pairs of patentheses ... require
-		 * no special treatment." */
+		case STR_ESC:
+			sink_putc(sink, '\\');
 
-		case '(':
-			if (depth >= 0 && balanced(p)) {
-				depth++;
-				fprintf(f, "(");
+			switch (p[i]) {
+			case '\\': sink_putc(sink, '\\'); continue;
+			case '\n': sink_putc(sink, 'n');  continue;
+			case '\r': sink_putc(sink, 'r');  continue;
+			case '\t': sink_putc(sink, 't');  continue;
+			case '\b': sink_putc(sink, 'b');  continue;
+			case '\f': sink_putc(sink, 'f');  continue;
+
+			default:
+				assert(!"unreached");
 				continue;
 			}
 
-			fprintf(f, "\\(");
-			continue;
+		case STR_PAREN:
+			if (p[i] == '(') {
+				if (u == NULL || (unext < ucount && u[unext] == i)) {
+					unext++;
+					sink_write(sink, "\\(", 2);
+					continue;
+				}
 
-		case ')':
-			if (depth > 0) {
+				depth++;
+				sink_putc(sink, '(');
+				continue;
+			}
+
+			if (u != NULL && depth > 0) {
 				depth--;
-				fprintf(f, ")");
+				sink_putc(sink, ')');
 				continue;
 			}
 
-			fprintf(f, "\\)");
+			sink_write(sink, "\\)", 2);
 			continue;
 
 		default:
-			fprintf(f, "%c", *p);
+			assert(!"unreached");
 			continue;
 		}
 	}
 
-	fprintf(f, ")");
+	sink_putc(sink, ')');
+
+	qdf_arena_release(&sink->arena, m);
 }
 
 static void
-print_bin(FILE *f, const void *p, size_t n)
+print_hex(struct qdf_sink *sink, unsigned char c)
 {
-	size_t i;
+	assert(sink != NULL);
+
+	memcpy(sink_reserve(sink, 2), hex_pairs + 2 * c, 2);
+	sink_commit(sink, 2);
+}
+
+static void
+print_bin(struct qdf_sink *sink, const void *p, size_t n)
+{
+	size_t k;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(p != NULL);
 
-	fprintf(f, "<");
+	sink_putc(sink, '<');
 
-	for (i = 0; i < n; i++) {
-		fprintf(f, "%02x", ((unsigned char *) p)[i]);
+	/* hex digits are encoded straight into the sink's buffer */
+	while (n > 0) {
+		k = (sink->size - sink->n) / 2;
+		if (k < 64 && k < n) {
+			sink_drain(sink);
+			k = sink->size / 2;
+		}
+
+		if (k > n) {
+			k = n;
+		}
+
+		hex_encode((char *) sink->buf + sink->n, p, k);
+		sink_commit(sink, 2 * k);
+
+		p = (const unsigned char *) p + k;
+		n -= k;
 	}
 
-	fprintf(f, ">");
+	sink_putc(sink, '>');
 }
 
 static void
-print_raw(FILE *f, const void *p, size_t n)
+print_raw(struct qdf_sink *sink, const void *p, size_t n)
 {
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(p != NULL);
 
-	fwrite(p, n, 1, f);
+	sink_write(sink, p, n);
 }
 
 static void
-print_name(FILE *f, const char *name)
+print_name(struct qdf_sink *sink, const char *name)
 {
-	const char *p;
+	const unsigned char *p = (const unsigned char *) name;
+	size_t i;
 
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(name != NULL);
 
 	/* ISO PDF 2.0 7.3.5 "Begnning with PDF 1.2 a name object is ..."
 	 * and 1.2 is the minimum version libqdf supports for this reason. */
 
-	fprintf(f, "/");
+	sink_putc(sink, '/');
 
-	for (p = name; *p != '\0'; p++) {
-		if (*p == '#') {
-			fprintf(f, "#%02x", (unsigned char) *p);
-			continue;
-		}
+	for (;;) {
+		/* '\0' is classed as needing escape, so this stops there too */
+		for (i = 0; !name_escape_class[p[i]]; i++)
+			;
 
-		if (!isprint((unsigned char) *p)) {
-			fprintf(f, "#%02x", (unsigned char) *p);
-			continue;
-		}
+		sink_write(sink, p, i);
+		p += i;
 
-		if (isspace((unsigned char) *p)) {
-			fprintf(f, "#%02x", (unsigned char) *p);
-			continue;
+		if (*p == '\0') {
+			break;
 		}
 
-		if (((unsigned char) *p) < 0x21 || ((unsigned char) *p) > 0x7e) {
-			fprintf(f, "#%02x", (unsigned char) *p);
-			continue;
-		}
+		sink_putc(sink, '#');
+		print_hex(sink, *p);
+		p++;
+	}
+}
+
+/*
+ * ISO PDF 2.0 7.2.3 Whitespace is needed between tokens only where both
+ * sides would otherwise run together as regular characters; delimiters
+ * ( ) < > [ ] / % stand by themselves.
+ */
+static bool
+starts_regular(enum token_type type)
+{
+	switch (type) {
+	case TOK_NULL:
+	case TOK_BOOL:
+	case TOK_INT:
+	case TOK_SIZE:
+	case TOK_REAL:
+	case TOK_REF:
+	case TOK_DEF_OPEN:
+	case TOK_STREAM_OPEN:
+		return true;
 
-		fprintf(f, "%c", *p);
+	default:
+		return false;
+	}
+}
+
+static bool
+ends_regular(enum token_type type)
+{
+	switch (type) {
+	case TOK_NULL:
+	case TOK_BOOL:
+	case TOK_INT:
+	case TOK_SIZE:
+	case TOK_REAL:
+	case TOK_NAME:
+	case TOK_REF:
+	case TOK_DEF_CLOSE:
+	case TOK_STREAM_CLOSE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* Tokens which end with an EOL, so that whatever follows begins a line */
+static bool
+ends_line(enum token_type type)
+{
+	switch (type) {
+	case TOK_VER:
+	case TOK_EOF:
+	case TOK_BR:
+	case TOK_COMMENT:
+	case TOK_DEF_OPEN:
+	case TOK_STREAM_OPEN:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool
+need_space(const struct qdf_sink *sink, enum token_type type)
+{
+	assert(sink != NULL);
+
+	if (sink->bol) {
+		return false;
+	}
+
+	/*
+	 * Stream data follows "stream" and its EOL immediately, and
+	 * must not gain any bytes before the EOL preceding "endstream".
+	 */
+	if (type == TOK_RAW || type == TOK_STREAM_CLOSE) {
+		return false;
+	}
+
+	/* these begin with an EOL, which delimits well enough */
+	if (type == TOK_BR || type == TOK_DEF_CLOSE) {
+		return false;
+	}
+
+	switch (sink->mode) {
+	case QDF_PRINT_READABLE:
+		return true;
+
+	case QDF_PRINT_COMPACT:
+		return sink->regular && starts_regular(type);
+
+	default:
+		assert(!"unreached");
+		return true;
 	}
 }
 
 void
-qdf_print_token(FILE *f, const struct token *t)
+qdf_print_token(struct qdf_sink *sink, const struct token *t)
 {
-	assert(f != NULL);
+	assert(sink != NULL);
 	assert(t != NULL);
 
 	/*
-	 * TODO: store previous token .type - that's why we want a struct token as a single entry point
 	 * TODO: indentation here
-	 * TODO: conditional whitespace here
 	 */
-	fprintf(f, " ");
+	if (need_space(sink, t->type)) {
+		sink_putc(sink, ' ');
+	}
 
 	switch (t->type) {
-	case TOK_VER:
-	case TOK_EOF:
-	case TOK_BR:
-		abort(); /* not implemented */
-
-	case TOK_COMMENT:     print_comment(f, t->u.comment);                   break;
-	case TOK_REAL:        print_real   (f, t->u.n);                         break;
-	case TOK_STRING:      print_string (f, t->u.s);                         break;
-	case TOK_BIN:         print_bin    (f, t->u.data.p, t->u.data.n);       break;
-	case TOK_RAW:         print_raw    (f, t->u.data.p, t->u.data.n);       break;
-	case TOK_NAME:        print_name   (f, t->u.name);                      break;
-
-	case TOK_NULL:        fprintf(f, "null");                               break;
-	case TOK_BOOL:        fprintf(f, "%s", t->u.v ? "true" : "false");      break;
-	case TOK_INT:         fprintf(f, "%" QDF_PRId, t->u.i);                 break;
-	case TOK_SIZE:        fprintf(f, "%zu", t->u.z);                        break;
-	case TOK_REF:         fprintf(f, "%u %u R", t->u.ref.id, t->u.ref.gen); break;
-	case TOK_ARRAY_OPEN:  fprintf(f, "[");                                  break;
-	case TOK_ARRAY_CLOSE: fprintf(f, "]");                                  break;
-	case TOK_DICT_OPEN:   fprintf(f, "<<");                                 break;
-	case TOK_DICT_CLOSE:  fprintf(f, ">>");                                 break;
+	case TOK_VER:         print_ver    (sink, t->u.ver);                       break;
+	case TOK_EOF:         sink_puts(sink, "%%EOF\n");                          break;
+	case TOK_BR:          sink_putc(sink, '\n');                               break;
+
+	case TOK_COMMENT:     print_comment(sink, t->u.comment);                   break;
+	case TOK_REAL:        print_real   (sink, t->u.n);                         break;
+	case TOK_STRING:      print_string (sink, t->u.data.p, t->u.data.n);       break;
+	case TOK_BIN:         print_bin    (sink, t->u.data.p, t->u.data.n);       break;
+	case TOK_RAW:         print_raw    (sink, t->u.data.p, t->u.data.n);       break;
+	case TOK_NAME:        print_name   (sink, t->u.name);                      break;
+
+	case TOK_NULL:        sink_puts(sink, "null");                             break;
+	case TOK_BOOL:        sink_puts(sink, t->u.v ? "true" : "false");          break;
+	case TOK_INT:         print_int    (sink, t->u.i);                         break;
+	case TOK_SIZE:        print_uint   (sink, t->u.z);                         break;
+	case TOK_REF:         print_ref    (sink, &t->u.ref, " R");                break;
+	case TOK_ARRAY_OPEN:  sink_putc(sink, '[');                                break;
+	case TOK_ARRAY_CLOSE: sink_putc(sink, ']');                                break;
+	case TOK_DICT_OPEN:   sink_write(sink, "<<", 2);                           break;
+	case TOK_DICT_CLOSE:  sink_write(sink, ">>", 2);                           break;
 
 	case TOK_DEF_OPEN:
-		fprintf(f, "%u %u obj\n", t->u.ref.id, t->u.ref.gen);
+		print_ref(sink, &t->u.ref, " obj\n");
 		break;
 
 	case TOK_DEF_CLOSE:
-		fprintf(f, "\n");
-		fprintf(f, "endobj");
+		sink_putc(sink, '\n');
+		sink_puts(sink, "endobj");
 		break;
 
 	case TOK_STREAM_OPEN:
-		fprintf(f, "stream\n");
+		sink_puts(sink, "stream\n");
 		break;
 
 	case TOK_STREAM_CLOSE:
@@ -303,16 +587,14 @@ qdf_print_token(FILE *f, const struct token *t)
 		 * ... before the keyword endstream."
 		 */
 
-		fprintf(f, "\n");
-		fprintf(f, "endstream");
+		sink_putc(sink, '\n');
+		sink_puts(sink, "endstream");
 		break;
 
 	default:
 		abort();
 	}
 
-	/*
-	 * TODO: save lexical state
-	 */
+	sink->regular = ends_regular(t->type);
+	sink->bol     = ends_line(t->type);
 }
-
@@ -0,0 +1,444 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+
+#include "filter.h"
+#include "rle.h"
+
+/*
+ * ISO PDF 2.0 7.4.5 RunLengthDecode. A length byte of 0 to 127 is followed
+ * by that many plus one literal bytes, and 129 to 255 by a single byte
+ * to be repeated 257 minus that many times. 128 marks EOD.
+ */
+enum {
+	RLE_MAX = 128,
+	RLE_EOD = 128
+};
+
+/*
+ * Run boundaries are found sixteen bytes at a time. The scalar loops
+ * finish off whatever remains, and serve for other targets.
+ */
+
+/* The number of leading bytes equal to c */
+static size_t
+rle_span(const unsigned char *p, size_t n, unsigned char c)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i v = _mm_set1_epi8((char) c);
+
+	for ( ; i + 16 <= n; i += 16) {
+		unsigned m;
+
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + i)), v));
+		if (m != 0xFFFF) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+#endif
+
+	while (i < n && p[i] == c) {
+		i++;
+	}
+
+	return i;
+}
+
+/* The first i where p[i] == p[i + 1], or n - 1 if there is none */
+static size_t
+rle_pair(const unsigned char *p, size_t n)
+{
+	size_t i = 0;
+
+	assert(n > 0);
+
+#if defined(__SSE2__)
+	for ( ; i + 17 <= n; i += 16) {
+		unsigned m;
+
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *) (p + i)),
+			_mm_loadu_si128((const __m128i *) (p + i + 1))));
+		if (m != 0) {
+			return i + __builtin_ctz(m);
+		}
+	}
+#endif
+
+	while (i + 1 < n && p[i] != p[i + 1]) {
+		i++;
+	}
+
+	return i;
+}
+
+/*
+ * Input is seen as a sequence of maximal runs, with the current run held
+ * over between calls since it may continue. Runs of one byte accumulate
+ * as a literal, and runs of three or more are always written as runs;
+ * that costs no more than extending a literal, even where the literal
+ * must be restarted afterwards. A run of two costs the same either way,
+ * so it joins a literal in progress rather than splitting it.
+ */
+struct rle_enc {
+	unsigned char c;
+	size_t run; /* count of c held, 0 for none */
+
+	size_t nlit;
+	unsigned char lit[RLE_MAX];
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+static bool
+rle_flush(struct filter_stage *st, unsigned char *out, size_t *n)
+{
+	assert(st != NULL);
+	assert(n != NULL);
+
+	if (*n == 0) {
+		return true;
+	}
+
+	if (!st->emit(st->opaque, out, *n)) {
+		return false;
+	}
+
+	*n = 0;
+
+	return true;
+}
+
+/* Room for one packet of either kind */
+static bool
+rle_reserve(struct filter_stage *st, struct rle_enc *r)
+{
+	assert(r != NULL);
+
+	if (sizeof r->out - r->n < 1 + RLE_MAX) {
+		return rle_flush(st, r->out, &r->n);
+	}
+
+	return true;
+}
+
+static bool
+rle_lit_flush(struct filter_stage *st, struct rle_enc *r)
+{
+	assert(r != NULL);
+
+	if (r->nlit == 0) {
+		return true;
+	}
+
+	if (!rle_reserve(st, r)) {
+		return false;
+	}
+
+	r->out[r->n++] = r->nlit - 1;
+	memcpy(r->out + r->n, r->lit, r->nlit);
+	r->n += r->nlit;
+	r->nlit = 0;
+
+	return true;
+}
+
+static bool
+rle_lit(struct filter_stage *st, struct rle_enc *r, const unsigned char *p, size_t n)
+{
+	size_t k;
+
+	assert(r != NULL);
+
+	while (n > 0) {
+		k = RLE_MAX - r->nlit;
+		if (k > n) {
+			k = n;
+		}
+
+		memcpy(r->lit + r->nlit, p, k);
+		r->nlit += k;
+		p += k;
+		n -= k;
+
+		if (r->nlit == RLE_MAX && !rle_lit_flush(st, r)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Writes the run held, which has ended */
+static bool
+rle_run(struct filter_stage *st, struct rle_enc *r)
+{
+	size_t k;
+
+	assert(r != NULL);
+
+	if (r->run == 1 || (r->run == 2 && r->nlit > 0 && r->nlit + 2 <= RLE_MAX)) {
+		unsigned char pair[2];
+
+		pair[0] = r->c;
+		pair[1] = r->c;
+
+		k = r->run;
+		r->run = 0;
+
+		return rle_lit(st, r, pair, k);
+	}
+
+	if (!rle_lit_flush(st, r)) {
+		return false;
+	}
+
+	while (r->run >= 2) {
+		k = r->run < RLE_MAX ? r->run : RLE_MAX;
+
+		if (!rle_reserve(st, r)) {
+			return false;
+		}
+
+		r->out[r->n++] = 257 - k;
+		r->out[r->n++] = r->c;
+		r->run -= k;
+	}
+
+	/* a single byte left over from a long run */
+	if (r->run == 1) {
+		r->run = 0;
+		return rle_lit(st, r, &r->c, 1);
+	}
+
+	return true;
+}
+
+static bool
+rle_enc_init(struct filter_stage *st)
+{
+	struct rle_enc *r;
+
+	assert(st != NULL);
+
+	r = malloc(sizeof *r);
+	if (r == NULL) {
+		return false;
+	}
+
+	r->run  = 0;
+	r->nlit = 0;
+	r->n    = 0;
+
+	st->state = r;
+
+	return true;
+}
+
+static bool
+rle_enc_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct rle_enc *r;
+	size_t i, k;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	r = st->state;
+
+	i = 0;
+
+	while (i < n) {
+		if (r->run > 0) {
+			k = rle_span(s + i, n - i, r->c);
+			r->run += k;
+			i += k;
+
+			if (i == n) {
+				break;
+			}
+
+			/* literal bytes run together until the next pair */
+			if (r->run == 1) {
+				k = rle_pair(s + i, n - i);
+				r->run = 0;
+
+				if (!rle_lit(st, r, &r->c, 1) || !rle_lit(st, r, s + i, k)) {
+					return false;
+				}
+
+				i += k;
+			} else if (!rle_run(st, r)) {
+				return false;
+			}
+		}
+
+		r->c   = s[i++];
+		r->run = 1;
+	}
+
+	return true;
+}
+
+static bool
+rle_enc_finish(struct filter_stage *st)
+{
+	struct rle_enc *r;
+
+	assert(st != NULL);
+
+	r = st->state;
+
+	if (r->run > 0 && !rle_run(st, r)) {
+		return false;
+	}
+
+	if (!rle_lit_flush(st, r) || !rle_reserve(st, r)) {
+		return false;
+	}
+
+	r->out[r->n++] = RLE_EOD;
+
+	return rle_flush(st, r->out, &r->n);
+}
+
+static void
+rle_fini(struct filter_stage *st)
+{
+	assert(st != NULL);
+
+	free(st->state);
+}
+
+struct rle_dec {
+	unsigned len;   /* the length byte of the packet in progress */
+	size_t pending; /* literal bytes still to come, or 0 */
+	bool started;   /* seen a length byte, which isn't yet satisfied */
+	bool eod;
+
+	size_t n;
+	unsigned char out[FILTER_CHUNK];
+};
+
+static bool
+rle_dec_init(struct filter_stage *st)
+{
+	struct rle_dec *r;
+
+	assert(st != NULL);
+
+	r = malloc(sizeof *r);
+	if (r == NULL) {
+		return false;
+	}
+
+	r->pending = 0;
+	r->started = false;
+	r->eod     = false;
+	r->n       = 0;
+
+	st->state = r;
+
+	return true;
+}
+
+static bool
+rle_dec_update(struct filter_stage *st, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	struct rle_dec *r;
+	size_t i, k;
+
+	assert(st != NULL);
+	assert(p != NULL || n == 0);
+
+	r = st->state;
+
+	i = 0;
+
+	while (i < n && !r->eod) {
+		if (sizeof r->out - r->n < RLE_MAX && !rle_flush(st, r->out, &r->n)) {
+			return false;
+		}
+
+		if (r->pending > 0) {
+			k = r->pending < n - i ? r->pending : n - i;
+			memcpy(r->out + r->n, s + i, k);
+			r->n += k;
+			r->pending -= k;
+			i += k;
+
+			r->started = r->pending > 0;
+			continue;
+		}
+
+		if (r->started) {
+			memset(r->out + r->n, s[i++], 257 - r->len);
+			r->n += 257 - r->len;
+			r->started = false;
+			continue;
+		}
+
+		r->len = s[i++];
+
+		if (r->len == RLE_EOD) {
+			r->eod = true;
+		} else if (r->len < RLE_EOD) {
+			r->pending = r->len + 1;
+			r->started = true;
+		} else {
+			r->started = true;
+		}
+	}
+
+	return true;
+}
+
+static bool
+rle_dec_finish(struct filter_stage *st)
+{
+	struct rle_dec *r;
+
+	assert(st != NULL);
+
+	r = st->state;
+
+	/* a missing EOD is tolerated, but not a truncated packet */
+	if (r->started) {
+		errno = EINVAL;
+		return false;
+	}
+
+	return rle_flush(st, r->out, &r->n);
+}
+
+const struct filter_ops rle_enc = {
+	rle_enc_init, rle_enc_update, rle_enc_finish, rle_fini
+};
+
+const struct filter_ops rle_dec = {
+	rle_dec_init, rle_dec_update, rle_dec_finish, rle_fini
+};
+
@@ -0,0 +1,14 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_RLE_INTERNAL_H
+#define LIBQDF_RLE_INTERNAL_H
+
+extern const struct filter_ops rle_enc;
+extern const struct filter_ops rle_dec;
+
+#endif
+
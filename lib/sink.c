@@ -0,0 +1,450 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+/* copy_file_range(2) is a GNU extension; pread(2) is POSIX */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#elif !defined(__linux__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <qdf/arena.h>
+#include <qdf/sink.h>
+
+#include "sink.h"
+
+static bool
+write_file(void *opaque, const struct iovec *iov, int iovcnt)
+{
+	FILE *f = opaque;
+	int i;
+
+	assert(f != NULL);
+	assert(iov != NULL);
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len == 0) {
+			continue;
+		}
+
+		if (fwrite(iov[i].iov_base, iov[i].iov_len, 1, f) != 1) {
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool
+sink_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct iovec v[2];
+	ssize_t r;
+
+	assert(fd != -1);
+	assert(iov != NULL);
+	assert(iovcnt <= (int) (sizeof v / sizeof *v));
+
+	memcpy(v, iov, iovcnt * sizeof *iov);
+
+	while (iovcnt > 0) {
+		r = writev(fd, v, iovcnt);
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		/* short write; skip what went out and resume */
+		while (iovcnt > 0 && (size_t) r >= v[0].iov_len) {
+			r -= v[0].iov_len;
+			memmove(v, v + 1, (iovcnt - 1) * sizeof *v);
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			v[0].iov_base = (char *) v[0].iov_base + r;
+			v[0].iov_len -= r;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The fd is carried in the opaque pointer itself, rather than read from
+ * the sink, so that a sink which is copied or moved still writes to it.
+ */
+static bool
+write_fd(void *opaque, const struct iovec *iov, int iovcnt)
+{
+	return sink_writev((int) (intptr_t) opaque, iov, iovcnt);
+}
+
+bool
+sink_hook_write(void *opaque, const struct iovec *iov, int iovcnt)
+{
+	const struct sink_hook *hook = opaque;
+
+	assert(hook != NULL);
+
+	return sink_writev(hook->fd, iov, iovcnt);
+}
+
+bool
+sink_note_ref(struct qdf_sink *sink, uint64_t offset, unsigned id)
+{
+	struct sink_hook *hook;
+
+	assert(sink != NULL);
+
+	if (sink->write != sink_hook_write) {
+		return true;
+	}
+
+	hook = sink->opaque;
+
+	return hook->ref(hook, offset, id);
+}
+
+static void
+emit(struct qdf_sink *sink, const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	assert(sink != NULL);
+	assert(sink->write != NULL);
+
+	if (sink->err != 0) {
+		return;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		sink->written += iov[i].iov_len;
+	}
+
+	errno = 0;
+
+	if (!sink->write(sink->opaque, iov, iovcnt)) {
+		sink->err = errno != 0 ? errno : EIO;
+	}
+}
+
+void
+sink_drain(struct qdf_sink *sink)
+{
+	assert(sink != NULL);
+
+	if (sink->n == 0) {
+		return;
+	}
+
+	emit(sink, & (struct iovec) { sink->buf, sink->n }, 1);
+
+	sink->n = 0;
+}
+
+void
+sink_write(struct qdf_sink *sink, const void *p, size_t n)
+{
+	size_t k;
+
+	assert(sink != NULL);
+	assert(p != NULL || n == 0);
+
+	if (n <= sink->size - sink->n) {
+		memcpy(sink->buf + sink->n, p, n);
+		sink->n += n;
+		return;
+	}
+
+	/*
+	 * Too big to be worth copying; hand over whatever is pending
+	 * together with the span itself.
+	 */
+	if (n >= sink->size) {
+		struct iovec iov[2];
+
+		iov[0].iov_base = sink->buf;
+		iov[0].iov_len  = sink->n;
+		iov[1].iov_base = (void *) p;
+		iov[1].iov_len  = n;
+
+		emit(sink, iov + (sink->n == 0), 2 - (sink->n == 0));
+
+		sink->n = 0;
+		return;
+	}
+
+	k = sink->size - sink->n;
+	memcpy(sink->buf + sink->n, p, k);
+	sink->n += k;
+
+	sink_drain(sink);
+
+	memcpy(sink->buf, (const char *) p + k, n - k);
+	sink->n = n - k;
+}
+
+/*
+ * Copies in kernel from fd to the sink's fd, by whichever of
+ * copy_file_range(2) and sendfile(2) is supported for the pair. Returns
+ * the bytes copied, stopping early where neither is supported.
+ */
+static size_t
+copy_kernel(struct qdf_sink *sink, int fd, off_t offset, size_t len)
+{
+	size_t done = 0;
+
+#if defined(__linux__)
+	bool use_cfr = true;
+	ssize_t r;
+
+	assert(sink != NULL);
+	assert(sink->fd != -1);
+
+	while (done < len) {
+		if (use_cfr) {
+			r = copy_file_range(fd, &offset, sink->fd, NULL, len - done, 0);
+		} else {
+			r = sendfile(sink->fd, fd, &offset, len - done);
+		}
+
+		if (r == -1 && errno == EINTR) {
+			continue;
+		}
+
+		/* copy_file_range(2) wants regular files, and not every pair of filesystems */
+		if (r == -1 && use_cfr) {
+			use_cfr = false;
+			continue;
+		}
+
+		/* unsupported, or the source is short; the caller finds out which */
+		if (r <= 0) {
+			break;
+		}
+
+		done += r;
+	}
+#else
+	(void) sink;
+	(void) fd;
+	(void) offset;
+	(void) len;
+#endif
+
+	return done;
+}
+
+#define SINK_COPY_MIN (QDF_SINK_BUFSZ / 4)
+
+bool
+sink_copy_fd(struct qdf_sink *sink, int fd, off_t offset, size_t len)
+{
+	size_t done;
+	ssize_t r;
+
+	assert(sink != NULL);
+	assert(fd != -1);
+
+	if (sink->err != 0) {
+		errno = sink->err;
+		return false;
+	}
+
+	/*
+	 * Anything pending goes first. Short spans aren't worth the write
+	 * that costs, and go by way of the buffer instead.
+	 */
+	if (sink->fd != -1 && len >= SINK_COPY_MIN) {
+		sink_drain(sink);
+
+		if (sink->err != 0) {
+			errno = sink->err;
+			return false;
+		}
+
+		done = copy_kernel(sink, fd, offset, len);
+
+		sink->written += done;
+
+		offset += done;
+		len    -= done;
+	}
+
+	/* otherwise by way of the buffer, with no copy besides */
+	while (len > 0) {
+		if (sink->n == sink->size) {
+			sink_drain(sink);
+
+			if (sink->err != 0) {
+				errno = sink->err;
+				return false;
+			}
+		}
+
+		r = pread(fd, sink->buf + sink->n, len < sink->size - sink->n ? len : sink->size - sink->n, offset);
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		/* the file is shorter than claimed */
+		if (r == 0) {
+			errno = EIO;
+			return false;
+		}
+
+		sink->n += r;
+		offset  += r;
+		len     -= r;
+	}
+
+	return true;
+}
+
+bool
+qdf_sink_init(struct qdf_sink *sink, void *buf, size_t size,
+	qdf_sink_write *write, void *opaque)
+{
+	assert(sink != NULL);
+	assert(write != NULL);
+
+	if (buf == NULL) {
+		if (size == 0) {
+			size = QDF_SINK_BUFSZ;
+		}
+
+		if (size < QDF_SINK_MIN) {
+			size = QDF_SINK_MIN;
+		}
+
+		buf = malloc(size);
+		if (buf == NULL) {
+			return false;
+		}
+
+		sink->owned = true;
+	} else {
+		if (size < QDF_SINK_MIN) {
+			errno = EINVAL;
+			return false;
+		}
+
+		sink->owned = false;
+	}
+
+	sink->write  = write;
+	sink->opaque = opaque;
+	sink->buf    = buf;
+	sink->size   = size;
+	sink->n      = 0;
+	sink->err    = 0;
+	sink->fd     = -1;
+
+	sink->precision = QDF_PRECISION_DEFAULT;
+	sink->mode      = QDF_PRINT_READABLE;
+	sink->regular   = false;
+	sink->bol       = true;
+	sink->written   = 0;
+
+	qdf_arena_init(&sink->arena, 0);
+
+	return true;
+}
+
+bool
+qdf_sink_init_file(struct qdf_sink *sink, void *buf, size_t size, FILE *f)
+{
+	assert(sink != NULL);
+	assert(f != NULL);
+
+	return qdf_sink_init(sink, buf, size, write_file, f);
+}
+
+bool
+qdf_sink_init_fd(struct qdf_sink *sink, void *buf, size_t size, int fd)
+{
+	assert(sink != NULL);
+	assert(fd != -1);
+
+	if (!qdf_sink_init(sink, buf, size, write_fd, (void *) (intptr_t) fd)) {
+		return false;
+	}
+
+	sink->fd = fd;
+
+	return true;
+}
+
+bool
+qdf_sink_flush(struct qdf_sink *sink)
+{
+	assert(sink != NULL);
+
+	sink_drain(sink);
+
+	if (sink->err != 0) {
+		errno = sink->err;
+		return false;
+	}
+
+	return true;
+}
+
+uint64_t
+qdf_sink_offset(const struct qdf_sink *sink)
+{
+	assert(sink != NULL);
+
+	return sink->written + sink->n;
+}
+
+bool
+qdf_sink_fini(struct qdf_sink *sink)
+{
+	bool r;
+
+	assert(sink != NULL);
+
+	r = qdf_sink_flush(sink);
+
+	if (sink->owned) {
+		free(sink->buf);
+	}
+
+	qdf_arena_fini(&sink->arena);
+
+	sink->buf  = NULL;
+	sink->size = 0;
+
+	return r;
+}
+
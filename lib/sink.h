@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_SINK_INTERNAL_H
+#define LIBQDF_SINK_INTERNAL_H
+
+void
+sink_drain(struct qdf_sink *sink);
+
+void
+sink_write(struct qdf_sink *sink, const void *p, size_t n);
+
+/* Writes everything in iov to fd, resuming after short writes */
+bool
+sink_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/*
+ * A sink made with sink_hook_write() as its write callback, and a
+ * struct sink_hook as its opaque, writes to hook->fd and is told the
+ * offset of the object number in each reference and object definition
+ * printed, for renumbering afterwards. The hook is typically embedded
+ * in whatever it reports to.
+ */
+struct sink_hook {
+	int fd;
+
+	/* Returns false with errno set */
+	bool (*ref)(struct sink_hook *hook, uint64_t offset, unsigned id);
+};
+
+bool
+sink_hook_write(void *opaque, const struct iovec *iov, int iovcnt);
+
+/* Returns false with errno set; true for a sink without a hook */
+bool
+sink_note_ref(struct qdf_sink *sink, uint64_t offset, unsigned id);
+
+/*
+ * Copies len bytes from fd at offset. For a sink made by qdf_sink_init_fd(),
+ * this is done in kernel where possible, so the data never enters userspace.
+ */
+bool
+sink_copy_fd(struct qdf_sink *sink, int fd, off_t offset, size_t len);
+
+/*
+ * Space for n bytes at the end of the buffer, to be formatted in place
+ * and then accounted for by sink_commit(). n must be small relative
+ * to the buffer; callers format at most a token's worth at a time.
+ */
+static inline unsigned char *
+sink_reserve(struct qdf_sink *sink, size_t n)
+{
+	assert(n <= sink->size);
+
+	if (sink->size - sink->n < n) {
+		sink_drain(sink);
+	}
+
+	return sink->buf + sink->n;
+}
+
+static inline void
+sink_commit(struct qdf_sink *sink, size_t n)
+{
+	assert(n <= sink->size - sink->n);
+
+	sink->n += n;
+}
+
+static inline void
+sink_putc(struct qdf_sink *sink, char c)
+{
+	if (sink->n == sink->size) {
+		sink_drain(sink);
+	}
+
+	sink->buf[sink->n++] = (unsigned char) c;
+}
+
+static inline void
+sink_puts(struct qdf_sink *sink, const char *s)
+{
+	sink_write(sink, s, strlen(s));
+}
+
+#endif
+
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+/* for pread(2) */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <qdf/version.h>
+#include <qdf/types.h>
+#include <qdf/params.h>
+#include <qdf/filter.h>
+#include <qdf/source.h>
+#include <qdf/arena.h>
+
+#include "filter.h"
+#include "source.h"
+
+bool
+source_length(const struct qdf_source *src, size_t *n)
+{
+	size_t k;
+	int i;
+
+	assert(src != NULL);
+	assert(n != NULL);
+
+	switch (src->type) {
+	case QDF_SOURCE_FD:
+		*n = src->u.fd.len;
+		return true;
+
+	case QDF_SOURCE_IOV:
+		k = 0;
+
+		for (i = 0; i < src->u.iov.iovcnt; i++) {
+			k += src->u.iov.iov[i].iov_len;
+		}
+
+		*n = k;
+		return true;
+
+	case QDF_SOURCE_READ:
+	default:
+		return false;
+	}
+}
+
+static bool
+pump_read(qdf_source_read *read, void *ropaque, unsigned char *buf,
+	qdf_filter_emit *emit, void *opaque)
+{
+	size_t n;
+
+	assert(read != NULL);
+	assert(buf != NULL);
+
+	for (;;) {
+		if (!read(ropaque, buf, SOURCE_CHUNK, &n)) {
+			return false;
+		}
+
+		if (n == 0) {
+			return true;
+		}
+
+		if (!emit(opaque, buf, n)) {
+			return false;
+		}
+	}
+}
+
+static bool
+pump_fd(int fd, off_t offset, size_t len, unsigned char *buf,
+	qdf_filter_emit *emit, void *opaque)
+{
+	ssize_t r;
+
+	assert(fd != -1);
+	assert(buf != NULL);
+
+	while (len > 0) {
+		r = pread(fd, buf, len < SOURCE_CHUNK ? len : SOURCE_CHUNK, offset);
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		/* the file is shorter than claimed */
+		if (r == 0) {
+			errno = EIO;
+			return false;
+		}
+
+		if (!emit(opaque, buf, r)) {
+			return false;
+		}
+
+		offset += r;
+		len    -= r;
+	}
+
+	return true;
+}
+
+bool
+source_pump(const struct qdf_source *src, struct qdf_arena *arena,
+	qdf_filter_emit *emit, void *opaque)
+{
+	struct qdf_arena_mark m;
+	unsigned char *buf;
+	bool r;
+	int i;
+
+	assert(src != NULL);
+	assert(arena != NULL);
+	assert(emit != NULL);
+
+	if (src->type == QDF_SOURCE_IOV) {
+		for (i = 0; i < src->u.iov.iovcnt; i++) {
+			if (!emit(opaque, src->u.iov.iov[i].iov_base, src->u.iov.iov[i].iov_len)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	m = qdf_arena_mark(arena);
+
+	buf = qdf_arena_alloc(arena, SOURCE_CHUNK);
+	if (buf == NULL) {
+		return false;
+	}
+
+	switch (src->type) {
+	case QDF_SOURCE_READ:
+		r = pump_read(src->u.read.read, src->u.read.opaque, buf, emit, opaque);
+		break;
+
+	case QDF_SOURCE_FD:
+		r = pump_fd(src->u.fd.fd, src->u.fd.offset, src->u.fd.len, buf, emit, opaque);
+		break;
+
+	default:
+		errno = EINVAL;
+		r = false;
+		break;
+	}
+
+	qdf_arena_release(arena, m);
+
+	return r;
+}
+
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2018 Katherine Flavel
+ *
+ * See LICENCE for the full copyright terms.
+ */
+
+#ifndef LIBQDF_SOURCE_INTERNAL_H
+#define LIBQDF_SOURCE_INTERNAL_H
+
+/* Read buffer for sources which aren't already in memory */
+#define SOURCE_CHUNK (64 * 1024)
+
+/* The length of the source's data, where it's known without reading it */
+bool
+source_length(const struct qdf_source *src, size_t *n);
+
+/*
+ * Reads the source through to its end, handing each chunk to emit().
+ * The read buffer comes from the arena, and is given back after.
+ */
+bool
+source_pump(const struct qdf_source *src, struct qdf_arena *arena,
+	qdf_filter_emit *emit, void *opaque);
+
+#endif
+
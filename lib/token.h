@@ -30,11 +30,6 @@ enum token_type {
 	TOK_STREAM_OPEN, TOK_STREAM_CLOSE
 };
 
-struct qdf_ref {
-	unsigned id;
-	unsigned gen;
-};
-
 struct token {
 	enum token_type type;
 	union {
@@ -55,7 +50,13 @@ struct token {
 };
 
 void
-qdf_print_token(FILE *f, const struct token *t);
+qdf_print_token(struct qdf_sink *sink, const struct token *t);
+
+/* As qdf_print_stream(), with extra entries leading the stream's dict */
+bool
+qdf_print_stream_with(struct qdf_sink *sink,
+	const struct token *extra, size_t extran,
+	const struct qdf_stream *st);
 
 #endif
 